@@ -0,0 +1,246 @@
+// Container workload benchmark.
+//
+// Measures insertion, iteration and erase throughput of std::map,
+// std::unordered_map, std::list and std::deque with zpp::static_allocator
+// against std::allocator. Insertion and erase order is shuffled so that
+// first fit placement and the resulting locality show up in iteration.
+//
+// Usage: containers [elements] [iterations]
+#include "../zpp_allocator.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+using clock = std::chrono::steady_clock;
+
+template <typename Type>
+using zpp_allocator = zpp::static_allocator<Type>;
+
+struct result
+{
+    double m_insert{};
+    double m_iterate{};
+    double m_erase{};
+};
+
+double nanoseconds(clock::time_point start, std::size_t operations)
+{
+    return std::chrono::duration<double, std::nano>(clock::now() - start)
+               .count() /
+           operations;
+}
+
+template <typename Container>
+std::uint64_t sum(const Container & container)
+{
+    std::uint64_t sum{};
+    for (auto & element : container) {
+        if constexpr (std::is_integral_v<
+                          std::decay_t<decltype(element)>>) {
+            sum += element;
+        } else {
+            sum += element.second;
+        }
+    }
+    return sum;
+}
+
+template <typename Container>
+result run_associative(const std::vector<std::uint64_t> & keys,
+                       std::size_t iterations,
+                       std::uint64_t & sink)
+{
+    result result;
+    Container container;
+
+    auto start = clock::now();
+    for (auto key : keys) {
+        container.emplace(key, key);
+    }
+    result.m_insert = nanoseconds(start, keys.size());
+
+    start = clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        sink += sum(container);
+    }
+    result.m_iterate = nanoseconds(start, keys.size() * iterations);
+
+    start = clock::now();
+    for (auto key = keys.rbegin(); key != keys.rend(); ++key) {
+        container.erase(*key);
+    }
+    result.m_erase = nanoseconds(start, keys.size());
+    return result;
+}
+
+template <typename Container>
+result run_list(const std::vector<std::uint64_t> & keys,
+                std::size_t iterations,
+                std::uint64_t & sink)
+{
+    result result;
+    Container container;
+    std::vector<typename Container::iterator> positions;
+    positions.reserve(keys.size());
+
+    // Insert alternately at the front and the back, and erase in shuffled
+    // order, so that the node order differs from the allocation order.
+    auto start = clock::now();
+    for (auto key : keys) {
+        if (key & 1) {
+            positions.push_back(container.insert(container.end(), key));
+        } else {
+            positions.push_back(container.insert(container.begin(), key));
+        }
+    }
+    result.m_insert = nanoseconds(start, keys.size());
+
+    start = clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        sink += sum(container);
+    }
+    result.m_iterate = nanoseconds(start, keys.size() * iterations);
+
+    std::shuffle(positions.begin(), positions.end(), std::mt19937_64(1));
+    start = clock::now();
+    for (auto position : positions) {
+        container.erase(position);
+    }
+    result.m_erase = nanoseconds(start, keys.size());
+    return result;
+}
+
+template <typename Container>
+result run_deque(const std::vector<std::uint64_t> & keys,
+                 std::size_t iterations,
+                 std::uint64_t & sink)
+{
+    result result;
+    Container container;
+
+    auto start = clock::now();
+    for (auto key : keys) {
+        if (key & 1) {
+            container.push_back(key);
+        } else {
+            container.push_front(key);
+        }
+    }
+    result.m_insert = nanoseconds(start, keys.size());
+
+    start = clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        sink += sum(container);
+    }
+    result.m_iterate = nanoseconds(start, keys.size() * iterations);
+
+    start = clock::now();
+    while (!container.empty()) {
+        if (container.size() & 1) {
+            container.pop_back();
+        } else {
+            container.pop_front();
+        }
+    }
+    result.m_erase = nanoseconds(start, keys.size());
+    return result;
+}
+
+void print(const char * container, const char * allocator, result result)
+{
+    std::printf("%-14s %-6s %12.2f %12.2f %12.2f\n",
+                container,
+                allocator,
+                result.m_insert,
+                result.m_iterate,
+                result.m_erase);
+}
+
+template <typename Type>
+using std_map = std::map<Type, Type>;
+template <typename Type>
+using zpp_map = std::map<Type,
+                         Type,
+                         std::less<Type>,
+                         zpp_allocator<std::pair<const Type, Type>>>;
+template <typename Type>
+using std_unordered_map = std::unordered_map<Type, Type>;
+template <typename Type>
+using zpp_unordered_map =
+    std::unordered_map<Type,
+                       Type,
+                       std::hash<Type>,
+                       std::equal_to<Type>,
+                       zpp_allocator<std::pair<const Type, Type>>>;
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::size_t elements = argc > 1 ? std::strtoull(argv[1], nullptr, 0)
+                                    : 100'000;
+    std::size_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 0)
+                                      : 10;
+
+    // Nodes of the largest container plus the bucket array of the
+    // unordered map, with room to spare for fragmentation.
+    auto heap_size = elements * 256 + (1 << 20);
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    zpp::heap<>::create(memory.get(), heap_size);
+
+    std::vector<std::uint64_t> keys(elements);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(0));
+
+    std::uint64_t sink{};
+    std::printf("%-14s %-6s %12s %12s %12s\n",
+                "container",
+                "alloc",
+                "insert ns",
+                "iterate ns",
+                "erase ns");
+
+    using type = std::uint64_t;
+    print("map",
+          "std",
+          run_associative<std_map<type>>(keys, iterations, sink));
+    print("map",
+          "zpp",
+          run_associative<zpp_map<type>>(keys, iterations, sink));
+    print("unordered_map",
+          "std",
+          run_associative<std_unordered_map<type>>(keys, iterations, sink));
+    print("unordered_map",
+          "zpp",
+          run_associative<zpp_unordered_map<type>>(keys, iterations, sink));
+    print("list",
+          "std",
+          run_list<std::list<type>>(keys, iterations, sink));
+    print("list",
+          "zpp",
+          run_list<std::list<type, zpp_allocator<type>>>(
+              keys, iterations, sink));
+    print("deque",
+          "std",
+          run_deque<std::deque<type>>(keys, iterations, sink));
+    print("deque",
+          "zpp",
+          run_deque<std::deque<type, zpp_allocator<type>>>(
+              keys, iterations, sink));
+
+    std::fprintf(stderr,
+                 "checksum %llu, allocated after run %zu\n",
+                 static_cast<unsigned long long>(sink),
+                 zpp::heap<>::get_allocator().allocated());
+    return 0;
+}
@@ -0,0 +1,282 @@
+// Coroutine frame allocation benchmark.
+//
+// Runs a pipeline of C++20 coroutines, a task that pulls values from a
+// chain of short generators and awaits a child task for every value, so
+// that every value creates and destroys at least one coroutine frame.
+// Times it with frames from the global operator new, from a zpp heap and
+// from a zpp heap with fast bins, through zpp::pooled_promise.
+//
+// Requires C++20: g++ -std=c++20 -O2 benchmark/coroutines.cpp
+//
+// Usage: coroutines [values] [iterations]
+#include "../zpp_allocator.h"
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <utility>
+
+namespace
+{
+using clock = std::chrono::steady_clock;
+
+// Values produced by each generator of the chain.
+constexpr std::uint64_t generator_length = 16;
+
+struct global_frames
+{
+};
+
+using heap_frames = zpp::pooled_promise<zpp::heap<0>>;
+
+using bin_heap = zpp::heap<
+    1,
+    zpp::basic_heap<zpp::fast_bins<zpp::first_fit, 512>>>;
+using bin_frames = zpp::pooled_promise<bin_heap>;
+
+template <typename Frames>
+class generator
+{
+public:
+    struct promise_type : Frames
+    {
+        generator get_return_object() noexcept
+        {
+            return generator{handle::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always final_suspend() noexcept
+        {
+            return {};
+        }
+
+        std::suspend_always yield_value(std::uint64_t value) noexcept
+        {
+            m_value = value;
+            return {};
+        }
+
+        void return_void() noexcept
+        {
+        }
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+
+        std::uint64_t m_value{};
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    generator(generator && other) noexcept :
+        m_handle(std::exchange(other.m_handle, nullptr))
+    {
+    }
+
+    ~generator()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool next()
+    {
+        m_handle.resume();
+        return !m_handle.done();
+    }
+
+    std::uint64_t value() const noexcept
+    {
+        return m_handle.promise().m_value;
+    }
+
+private:
+    explicit generator(handle handle) noexcept : m_handle(handle)
+    {
+    }
+
+    handle m_handle;
+};
+
+template <typename Frames>
+class task
+{
+public:
+    struct promise_type : Frames
+    {
+        struct final_awaiter
+        {
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<>
+            await_suspend(std::coroutine_handle<promise_type> self) noexcept
+            {
+                if (auto continuation = self.promise().m_continuation) {
+                    return continuation;
+                }
+                return std::noop_coroutine();
+            }
+
+            void await_resume() noexcept
+            {
+            }
+        };
+
+        task get_return_object() noexcept
+        {
+            return task{handle::from_promise(*this)};
+        }
+
+        std::suspend_always initial_suspend() noexcept
+        {
+            return {};
+        }
+
+        final_awaiter final_suspend() noexcept
+        {
+            return {};
+        }
+
+        void return_value(std::uint64_t value) noexcept
+        {
+            m_value = value;
+        }
+
+        void unhandled_exception() noexcept
+        {
+            std::terminate();
+        }
+
+        std::coroutine_handle<> m_continuation;
+        std::uint64_t m_value{};
+    };
+
+    using handle = std::coroutine_handle<promise_type>;
+
+    task(task && other) noexcept :
+        m_handle(std::exchange(other.m_handle, nullptr))
+    {
+    }
+
+    ~task()
+    {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    handle await_suspend(std::coroutine_handle<> continuation) noexcept
+    {
+        m_handle.promise().m_continuation = continuation;
+        return m_handle;
+    }
+
+    std::uint64_t await_resume() const noexcept
+    {
+        return m_handle.promise().m_value;
+    }
+
+    // Runs a task that never suspends on anything but its children.
+    std::uint64_t get()
+    {
+        m_handle.resume();
+        return m_handle.promise().m_value;
+    }
+
+private:
+    explicit task(handle handle) noexcept : m_handle(handle)
+    {
+    }
+
+    handle m_handle;
+};
+
+template <typename Frames>
+generator<Frames> numbers(std::uint64_t begin, std::uint64_t end)
+{
+    for (auto value = begin; value < end; ++value) {
+        co_yield value;
+    }
+}
+
+template <typename Frames>
+task<Frames> square(std::uint64_t value)
+{
+    co_return value * value;
+}
+
+template <typename Frames>
+task<Frames> pipeline(std::uint64_t values)
+{
+    std::uint64_t sum{};
+    for (std::uint64_t begin = 0; begin < values; begin += generator_length) {
+        auto source = numbers<Frames>(begin, begin + generator_length);
+        while (source.next()) {
+            sum += co_await square<Frames>(source.value());
+        }
+    }
+    co_return sum;
+}
+
+template <typename Frames>
+double run(std::uint64_t values, std::size_t iterations, std::uint64_t & sink)
+{
+    auto start = clock::now();
+    for (std::size_t i = 0; i < iterations; ++i) {
+        sink += pipeline<Frames>(values).get();
+    }
+    auto frames = (values + values / generator_length + 1) * iterations;
+    return std::chrono::duration<double, std::nano>(clock::now() - start)
+               .count() /
+           frames;
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::uint64_t values = argc > 1 ? std::strtoull(argv[1], nullptr, 0)
+                                    : 1'000'000;
+    std::size_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 0)
+                                      : 10;
+
+    // Only a handful of frames are alive at any time.
+    constexpr std::size_t heap_size = 1 << 20;
+    auto memory = std::make_unique<std::byte[]>(2 * heap_size);
+    zpp::heap<0>::create(memory.get(), heap_size);
+    bin_heap::create(memory.get() + heap_size, heap_size);
+
+    std::uint64_t sink{};
+    std::printf("%-10s %12s\n", "frames", "ns per frame");
+    std::printf("%-10s %12.2f\n", "global",
+                run<global_frames>(values, iterations, sink));
+    std::printf("%-10s %12.2f\n", "heap",
+                run<heap_frames>(values, iterations, sink));
+    std::printf("%-10s %12.2f\n", "fast_bins",
+                run<bin_frames>(values, iterations, sink));
+
+    std::fprintf(stderr,
+                 "checksum %llu, allocated after run %zu %zu\n",
+                 static_cast<unsigned long long>(sink),
+                 zpp::heap<0>::get_allocator().allocated(),
+                 bin_heap::get_allocator().allocated());
+    return 0;
+}
@@ -0,0 +1,281 @@
+// Long running fragmentation stress benchmark.
+//
+// Runs a stream of allocations with lognormally distributed sizes and a
+// mix of short and long lifetimes against a single heap, and prints a CSV
+// row per interval with the throughput, the number of free nodes and the
+// largest free node. The first allocation that fails while the heap still
+// has enough free bytes to satisfy it is reported as the fragmentation
+// point. When hints is nonzero, short lived allocations are made with
+// zpp::lifetime::short_lived.
+//
+// When phases is nonzero, runs instead that many phases that each grow
+// the long lived blocks with a burst of transient blocks allocated after
+// every one of them, frees the transient blocks and a quarter of the long
+// lived ones, once without and once with the short lived hint, and prints
+// a CSV row per phase with the free nodes and largest free node of both.
+//
+// Usage: fragmentation [operations] [heap size] [interval] [seed] [hints]
+//                      [phases]
+#include "../zpp_allocator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <random>
+#include <vector>
+
+namespace
+{
+struct allocation
+{
+    std::uint64_t m_death{};
+    std::byte * m_pointer{};
+    std::size_t m_size{};
+
+    friend bool operator>(const allocation & left,
+                          const allocation & right) noexcept
+    {
+        return left.m_death > right.m_death;
+    }
+};
+
+struct block
+{
+    std::byte * m_pointer{};
+    std::size_t m_size{};
+};
+
+struct phase
+{
+    std::size_t m_free_nodes{};
+    std::size_t m_largest_free_node{};
+};
+
+std::uint64_t argument(int argc, char ** argv, int index,
+                       std::uint64_t default_value)
+{
+    if (argc <= index) {
+        return default_value;
+    }
+    return std::strtoull(argv[index], nullptr, 0);
+}
+
+// Without the hint the transient blocks of a burst are placed between the
+// long lived blocks, and the holes they leave are pinned by them.
+std::vector<phase> run_phases(std::uint64_t phases,
+                              std::uint64_t heap_size,
+                              std::uint64_t seed,
+                              bool hints,
+                              std::uint64_t & failures)
+{
+    constexpr std::size_t growth = 2000;
+    constexpr std::size_t burst = 8;
+
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    zpp::allocator<std::byte> allocator(memory.get(), heap_size);
+
+    std::mt19937_64 random(seed);
+    std::lognormal_distribution<double> size_distribution(4.2, 1.3);
+
+    std::vector<block> long_lived;
+    std::vector<block> transient;
+    std::vector<phase> result;
+    auto allocate = [&](std::vector<block> & blocks, zpp::lifetime hint) {
+        auto size = static_cast<std::size_t>(size_distribution(random)) + 1;
+        if (auto pointer = allocator.allocate(size, hint)) {
+            blocks.push_back({pointer, size});
+        } else {
+            ++failures;
+        }
+    };
+
+    for (std::uint64_t i = 0; i < phases; ++i) {
+        for (std::size_t j = 0; j < growth; ++j) {
+            allocate(long_lived, zpp::lifetime::long_lived);
+            for (std::size_t k = 0; k < burst; ++k) {
+                allocate(transient,
+                         hints ? zpp::lifetime::short_lived
+                               : zpp::lifetime::long_lived);
+            }
+        }
+
+        for (auto & block : transient) {
+            allocator.deallocate(block.m_pointer, block.m_size);
+        }
+        transient.clear();
+
+        std::shuffle(long_lived.begin(), long_lived.end(), random);
+        auto kept = long_lived.size() - long_lived.size() / 4;
+        for (auto j = kept; j < long_lived.size(); ++j) {
+            allocator.deallocate(long_lived[j].m_pointer,
+                                 long_lived[j].m_size);
+        }
+        long_lived.resize(kept);
+
+        result.push_back(
+            {allocator.free_nodes(), allocator.largest_free_node()});
+    }
+
+    for (auto & block : long_lived) {
+        allocator.deallocate(block.m_pointer, block.m_size);
+    }
+    return result;
+}
+
+// Compares the phases without and with the hint, the summary averages the
+// second half of the phases, once the long lived blocks stopped growing.
+int compare_phases(std::uint64_t phases,
+                   std::uint64_t heap_size,
+                   std::uint64_t seed)
+{
+    std::uint64_t failures[2]{};
+    std::vector<phase> results[2] = {
+        run_phases(phases, heap_size, seed, false, failures[0]),
+        run_phases(phases, heap_size, seed, true, failures[1]),
+    };
+
+    std::printf("phase,free_nodes,largest_free_node,hinted_free_nodes,"
+                "hinted_largest_free_node\n");
+    for (std::uint64_t i = 0; i < phases; ++i) {
+        std::printf("%llu,%zu,%zu,%zu,%zu\n",
+                    static_cast<unsigned long long>(i + 1),
+                    results[0][i].m_free_nodes,
+                    results[0][i].m_largest_free_node,
+                    results[1][i].m_free_nodes,
+                    results[1][i].m_largest_free_node);
+    }
+
+    for (std::size_t hints = 0; hints < 2; ++hints) {
+        double free_nodes{};
+        double largest_free_node{};
+        for (auto i = phases / 2; i < phases; ++i) {
+            free_nodes += results[hints][i].m_free_nodes;
+            largest_free_node += results[hints][i].m_largest_free_node;
+        }
+        auto count = static_cast<double>(phases - phases / 2);
+        std::fprintf(stderr,
+                     "%s: mean free nodes %.0f, mean largest free node %.0f, "
+                     "%llu failures\n",
+                     hints ? "hinted" : "unhinted",
+                     free_nodes / count,
+                     largest_free_node / count,
+                     static_cast<unsigned long long>(failures[hints]));
+    }
+    return 0;
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    auto operations = argument(argc, argv, 1, 100'000'000);
+    auto heap_size = argument(argc, argv, 2, 64 << 20);
+    auto interval = argument(argc, argv, 3, 1'000'000);
+    auto seed = argument(argc, argv, 4, 0x5eed);
+    auto hints = argument(argc, argv, 5, 0);
+    auto phases = argument(argc, argv, 6, 0);
+
+    if (phases) {
+        return compare_phases(phases, heap_size, seed);
+    }
+
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    zpp::allocator<std::byte> allocator(memory.get(), heap_size);
+
+    std::mt19937_64 random(seed);
+
+    // Median size of 64 bytes with a long tail of large blocks.
+    std::lognormal_distribution<double> size_distribution(4.2, 1.3);
+
+    // Most objects die within a few hundred operations, the rest live
+    // for about a million operations.
+    std::bernoulli_distribution long_lived(0.05);
+    std::exponential_distribution<double> short_lifetime(1.0 / 256);
+    std::exponential_distribution<double> long_lifetime(1.0 / 1'000'000);
+
+    std::vector<allocation> storage;
+    storage.reserve(1 << 20);
+    std::priority_queue<allocation,
+                        std::vector<allocation>,
+                        std::greater<allocation>>
+        live(std::greater<allocation>{}, std::move(storage));
+
+    std::uint64_t failures{};
+    std::uint64_t fragmentation_point{};
+    auto start = std::chrono::steady_clock::now();
+    auto last = start;
+
+    std::printf("operations,mops,allocated,live,free_nodes,largest_free_node,"
+                "failures\n");
+
+    for (std::uint64_t operation = 0; operation < operations; ++operation) {
+        // Free everything whose lifetime has ended.
+        while (!live.empty() && live.top().m_death <= operation) {
+            allocator.deallocate(live.top().m_pointer, live.top().m_size);
+            live.pop();
+        }
+
+        auto size = static_cast<std::size_t>(size_distribution(random)) + 1;
+        auto is_long_lived = long_lived(random);
+        auto lifetime = is_long_lived ? long_lifetime(random)
+                                      : short_lifetime(random);
+
+        auto pointer = hints && !is_long_lived
+                           ? allocator.allocate(size,
+                                                zpp::lifetime::short_lived)
+                           : allocator.allocate(size);
+        if (!pointer) {
+            ++failures;
+            if (!fragmentation_point &&
+                allocator.size() - allocator.allocated() >= size) {
+                fragmentation_point = operation + 1;
+                std::fprintf(stderr,
+                             "fragmentation point: operation %llu, size %zu, "
+                             "free bytes %zu, free nodes %zu, largest free "
+                             "node %zu\n",
+                             static_cast<unsigned long long>(operation),
+                             size,
+                             allocator.size() - allocator.allocated(),
+                             allocator.free_nodes(),
+                             allocator.largest_free_node());
+            }
+        } else {
+            live.push({operation + 1 + static_cast<std::uint64_t>(lifetime),
+                       pointer,
+                       size});
+        }
+
+        if ((operation + 1) % interval == 0) {
+            auto now = std::chrono::steady_clock::now();
+            auto seconds = std::chrono::duration<double>(now - last).count();
+            last = now;
+            std::printf("%llu,%.3f,%zu,%zu,%zu,%zu,%llu\n",
+                        static_cast<unsigned long long>(operation + 1),
+                        interval / seconds / 1e6,
+                        allocator.allocated(),
+                        live.size(),
+                        allocator.free_nodes(),
+                        allocator.largest_free_node(),
+                        static_cast<unsigned long long>(failures));
+            std::fflush(stdout);
+        }
+    }
+
+    while (!live.empty()) {
+        allocator.deallocate(live.top().m_pointer, live.top().m_size);
+        live.pop();
+    }
+
+    auto seconds = std::chrono::duration<double>(
+                       std::chrono::steady_clock::now() - start)
+                       .count();
+    std::fprintf(stderr,
+                 "total: %.3f Mops/s, %llu failures, fragmentation point %llu, "
+                 "free nodes after drain %zu\n",
+                 operations / seconds / 1e6,
+                 static_cast<unsigned long long>(failures),
+                 static_cast<unsigned long long>(fragmentation_point),
+                 allocator.free_nodes());
+    return 0;
+}
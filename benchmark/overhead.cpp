@@ -0,0 +1,98 @@
+// Memory overhead benchmark.
+//
+// Fills a heap with a number of objects of a single size, for sizes from
+// 1 byte to 64 KiB, and prints the number of heap bytes consumed per
+// requested byte. When a baseline produced by a previous run is given, the
+// program fails if any size consumes more than it did in the baseline, so
+// that overhead regressions are caught like speed regressions.
+//
+// Usage: overhead [objects] [baseline.csv]
+#include "../zpp_allocator.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <vector>
+
+namespace
+{
+std::map<std::size_t, double> read_baseline(const char * path)
+{
+    std::map<std::size_t, double> baseline;
+    auto file = std::fopen(path, "r");
+    if (!file) {
+        std::fprintf(stderr, "cannot open baseline %s\n", path);
+        std::exit(2);
+    }
+
+    // Skip the header line.
+    std::fscanf(file, "%*[^\n]\n");
+
+    std::size_t size{};
+    std::size_t objects{};
+    std::size_t consumed{};
+    double ratio{};
+    while (std::fscanf(file, "%zu,%zu,%zu,%lf\n", &size, &objects, &consumed,
+                       &ratio) == 4) {
+        baseline[size] = ratio;
+    }
+    std::fclose(file);
+    return baseline;
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::size_t objects = argc > 1 ? std::strtoull(argv[1], nullptr, 0)
+                                   : 1024;
+    auto baseline = argc > 2 ? read_baseline(argv[2])
+                             : std::map<std::size_t, double>{};
+
+    constexpr std::size_t max_size = 64 * 1024;
+    auto heap_size = objects * (max_size + 1024);
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    std::vector<std::byte *> pointers(objects);
+
+    int regressions{};
+    // Every size up to 128 bytes, then steps of an eighth.
+    std::vector<std::size_t> sizes;
+    for (std::size_t size = 1; size < max_size;
+         size += (size < 128 ? 1 : size / 8)) {
+        sizes.push_back(size);
+    }
+    sizes.push_back(max_size);
+
+    std::printf("size,objects,consumed,ratio\n");
+    for (auto size : sizes) {
+        zpp::allocator<std::byte> allocator(memory.get(), heap_size);
+
+        for (auto & pointer : pointers) {
+            pointer = allocator.allocate(size);
+            if (!pointer) {
+                std::fprintf(stderr, "allocation of %zu bytes failed\n", size);
+                return 2;
+            }
+        }
+
+        auto consumed = allocator.allocated();
+        auto ratio = double(consumed) / double(objects * size);
+        std::printf("%zu,%zu,%zu,%.6f\n", size, objects, consumed, ratio);
+
+        if (auto entry = baseline.find(size);
+            entry != baseline.end() && ratio > entry->second * 1.0001) {
+            std::fprintf(stderr,
+                         "regression: size %zu consumes %.6f bytes per byte, "
+                         "baseline %.6f\n",
+                         size,
+                         ratio,
+                         entry->second);
+            ++regressions;
+        }
+
+        for (auto pointer : pointers) {
+            allocator.deallocate(pointer, size);
+        }
+    }
+
+    return regressions ? 1 : 0;
+}
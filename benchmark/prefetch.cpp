@@ -0,0 +1,124 @@
+// Free list prefetch benchmark.
+//
+// Builds a heap whose free list is long and scattered: small free nodes
+// separated by allocated pads of random sizes, so that every step of the
+// walk is a cache miss the hardware prefetcher cannot predict. Then times
+// allocations that only fit past the end of the list, and deallocations
+// of blocks whose previous free node is far behind, with and without the
+// prefetch ahead mode of the first fit and best fit policies.
+//
+// Usage: prefetch [free nodes] [iterations]
+#include "../zpp_allocator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace
+{
+using clock = std::chrono::steady_clock;
+
+struct result
+{
+    double m_find{};
+    double m_insert{};
+};
+
+template <typename FitPolicy>
+result run(std::size_t free_nodes, std::size_t iterations)
+{
+    constexpr std::size_t small_size = 32;
+    constexpr std::size_t large_size = 64 * 1024;
+    constexpr std::size_t min_pad = 256;
+    constexpr std::size_t max_pad = 4096;
+
+    auto heap_size =
+        free_nodes * (small_size + 2 * max_pad + 256) + 4 * large_size;
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    zpp::basic_heap<FitPolicy> heap(memory.get(), heap_size);
+
+    // Alternate small blocks and pads, then free the small blocks, and
+    // follow with a chain of allocated blocks without free nodes.
+    std::mt19937_64 random(0);
+    std::uniform_int_distribution<std::size_t> pad_size(min_pad, max_pad);
+    std::vector<std::byte *> small(free_nodes);
+    std::vector<std::byte *> pads(free_nodes);
+    std::vector<std::byte *> chain(free_nodes);
+    for (std::size_t i = 0; i < free_nodes; ++i) {
+        small[i] = heap.allocate(small_size);
+        pads[i] = heap.allocate(pad_size(random));
+    }
+    for (auto & pointer : chain) {
+        pointer = heap.allocate(pad_size(random));
+    }
+    for (auto pointer : small) {
+        heap.deallocate(pointer, small_size);
+    }
+
+    // Evict the heap from the cache between the measurements.
+    std::vector<std::byte> flush(64 << 20);
+    auto evict = [&] {
+        for (std::size_t i = 0; i < flush.size(); i += 64) {
+            flush[i] = std::byte(i);
+        }
+    };
+
+    result result;
+    double find{};
+    double insert{};
+    for (std::size_t i = 0; i < iterations; ++i) {
+        // Only the tail of the heap fits, so the walk visits every node.
+        evict();
+        auto start = clock::now();
+        auto pointer = heap.allocate(large_size);
+        find += std::chrono::duration<double, std::micro>(clock::now() - start)
+                    .count();
+        if (!pointer) {
+            std::fprintf(stderr, "allocation failed\n");
+            std::exit(2);
+        }
+        heap.deallocate(pointer, large_size);
+
+        // The one before the last block of the chain has allocated
+        // neighbours, so freeing it walks back over the whole chain to the
+        // previous free node.
+        evict();
+        auto last = chain[chain.size() - 2];
+        auto last_size = heap.allocation_size(last);
+        start = clock::now();
+        heap.deallocate(last, last_size);
+        insert += std::chrono::duration<double, std::micro>(clock::now() -
+                                                            start)
+                      .count();
+        chain[chain.size() - 2] = heap.allocate(last_size);
+    }
+    result.m_find = find / iterations;
+    result.m_insert = insert / iterations;
+    return result;
+}
+
+void print(const char * policy, result result)
+{
+    std::printf("%-16s %12.2f %12.2f\n", policy, result.m_find,
+                result.m_insert);
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::size_t free_nodes = argc > 1 ? std::strtoull(argv[1], nullptr, 0)
+                                      : 50'000;
+    std::size_t iterations = argc > 2 ? std::strtoull(argv[2], nullptr, 0)
+                                      : 20;
+
+    std::printf("%-16s %12s %12s\n", "policy", "find us", "insert us");
+    print("first_fit", run<zpp::first_fit>(free_nodes, iterations));
+    print("first_fit+pf",
+          run<zpp::basic_first_fit<true>>(free_nodes, iterations));
+    print("best_fit", run<zpp::best_fit>(free_nodes, iterations));
+    print("best_fit+pf",
+          run<zpp::basic_best_fit<true>>(free_nodes, iterations));
+    return 0;
+}
@@ -0,0 +1,169 @@
+// Free list scan length benchmark.
+//
+// Runs a churn workload, a fixed number of live allocations of random
+// sizes where every operation frees a random live allocation and
+// allocates a new one, against first fit and next fit. Prints the mean
+// number of free nodes examined per allocation, the throughput, and the
+// fragmentation of the heap at the end of the run.
+//
+// Usage: scan [operations] [live allocations] [seed]
+#include "../zpp_allocator.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+namespace
+{
+// Counts the free nodes that a search of the fit policy examines, by
+// walking its free list from where the search starts to the node found.
+template <typename FitPolicy>
+struct counting
+{
+    template <typename Node>
+    class index : public FitPolicy::template index<Node>
+    {
+    public:
+        Node * find(std::size_t size) const noexcept
+        {
+            auto start = this->m_first;
+            if constexpr (std::is_same_v<FitPolicy, zpp::next_fit>) {
+                if (this->m_rover) {
+                    start = this->m_rover;
+                }
+            }
+
+            auto found = FitPolicy::template index<Node>::find(size);
+
+            // Walk to the end and wrap around, up to the found node.
+            for (auto p = start; p;) {
+                ++scanned;
+                if (p == found) {
+                    break;
+                }
+                p = p->next_free();
+                if (!p) {
+                    p = this->m_first;
+                }
+                if (p == start) {
+                    break;
+                }
+            }
+            ++searches;
+            return found;
+        }
+    };
+
+    inline static std::uint64_t scanned{};
+    inline static std::uint64_t searches{};
+};
+
+struct allocation
+{
+    std::byte * m_pointer{};
+    std::size_t m_size{};
+};
+
+struct result
+{
+    double m_seconds{};
+    std::size_t m_free_nodes{};
+    std::size_t m_largest_free_node{};
+    std::uint64_t m_failures{};
+};
+
+template <typename FitPolicy>
+result churn(std::uint64_t operations,
+             std::size_t live_count,
+             std::uint64_t seed)
+{
+    auto heap_size = live_count * 1024 + (1 << 20);
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    zpp::basic_heap<FitPolicy> heap(memory.get(), heap_size);
+
+    std::mt19937_64 random(seed);
+
+    // Median size of 64 bytes with a tail of larger blocks.
+    std::lognormal_distribution<double> size_distribution(4.2, 1.0);
+    auto next_size = [&] {
+        auto size = static_cast<std::size_t>(size_distribution(random)) + 1;
+        return size < 4096 ? size : 4096;
+    };
+
+    std::vector<allocation> live(live_count);
+    for (auto & allocation : live) {
+        allocation.m_size = next_size();
+        allocation.m_pointer = heap.allocate(allocation.m_size);
+    }
+
+    result result;
+    auto start = std::chrono::steady_clock::now();
+    for (std::uint64_t operation = 0; operation < operations; ++operation) {
+        auto & allocation = live[random() % live_count];
+        if (allocation.m_pointer) {
+            heap.deallocate(allocation.m_pointer, allocation.m_size);
+        }
+        allocation.m_size = next_size();
+        allocation.m_pointer = heap.allocate(allocation.m_size);
+        result.m_failures += !allocation.m_pointer;
+    }
+    result.m_seconds = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+    result.m_free_nodes = heap.free_nodes();
+    result.m_largest_free_node = heap.largest_free_node();
+
+    for (auto & allocation : live) {
+        if (allocation.m_pointer) {
+            heap.deallocate(allocation.m_pointer, allocation.m_size);
+        }
+    }
+    return result;
+}
+
+template <typename FitPolicy>
+void run(const char * name,
+         std::uint64_t operations,
+         std::size_t live_count,
+         std::uint64_t seed)
+{
+    // The throughput is measured without the counting walks.
+    using policy = counting<FitPolicy>;
+    policy::scanned = 0;
+    policy::searches = 0;
+    churn<policy>(operations, live_count, seed);
+    auto result = churn<FitPolicy>(operations, live_count, seed);
+
+    std::printf("%-10s %12.2f %10.3f %10zu %12zu %10llu\n",
+                name,
+                double(policy::scanned) / double(policy::searches),
+                operations / result.m_seconds / 1e6,
+                result.m_free_nodes,
+                result.m_largest_free_node,
+                static_cast<unsigned long long>(result.m_failures));
+}
+} // namespace
+
+int main(int argc, char ** argv)
+{
+    std::uint64_t operations = argc > 1 ? std::strtoull(argv[1], nullptr, 0)
+                                        : 2'000'000;
+    std::size_t live_count = argc > 2 ? std::strtoull(argv[2], nullptr, 0)
+                                      : 10'000;
+    std::uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 0)
+                                  : 0x5eed;
+
+    std::printf("%-10s %12s %10s %10s %12s %10s\n",
+                "policy",
+                "mean scan",
+                "mops",
+                "free nodes",
+                "largest free",
+                "failures");
+    run<zpp::first_fit>("first_fit", operations, live_count, seed);
+    run<zpp::next_fit>("next_fit", operations, live_count, seed);
+    return 0;
+}
@@ -0,0 +1,476 @@
+// Differential fuzzing harness.
+//
+// Decodes the input into a sequence of allocate, deallocate and reallocate
+// operations, applies them to each zpp engine and checks every result
+// against a simple reference model of the live allocations:
+// - allocations never overlap and never leave the heap,
+// - returned pointers honour the heap alignment,
+// - allocation_size() covers the request and allocated() moves by exactly
+//   the block size,
+// - the contents of live allocations are never clobbered,
+// - once everything is freed the heap coalesces back to a single node.
+//
+// Build with libFuzzer:
+//   clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address fuzz/differential.cpp
+// Or as a standalone program that replays the given inputs, or random inputs
+// when none are given:
+//   g++ -std=c++17 -g -O1 -DZPP_FUZZ_STANDALONE fuzz/differential.cpp
+#include "../zpp_allocator.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t heap_size = 1 << 16;
+constexpr std::size_t max_operations = 4096;
+
+void check(bool condition, const char * message)
+{
+    if (!condition) {
+        std::fprintf(stderr, "check failed: %s\n", message);
+        std::abort();
+    }
+}
+
+class input
+{
+public:
+    input(const std::uint8_t * data, std::size_t size) :
+        m_data(data), m_size(size)
+    {
+    }
+
+    bool empty() const noexcept
+    {
+        return !m_size;
+    }
+
+    std::uint8_t byte() noexcept
+    {
+        if (!m_size) {
+            return 0;
+        }
+        --m_size;
+        return *m_data++;
+    }
+
+    std::size_t size() noexcept
+    {
+        // Mostly small sizes, sometimes anything up to the heap size.
+        auto selector = byte();
+        std::size_t value = byte() | (std::size_t(byte()) << 8);
+        if (selector & 0x80) {
+            return value % (heap_size / 2) + 1;
+        }
+        return value % 512 + 1;
+    }
+
+private:
+    const std::uint8_t * m_data{};
+    std::size_t m_size{};
+};
+
+struct allocation
+{
+    std::size_t m_size{};
+    std::uint8_t m_pattern{};
+};
+
+template <typename Allocator, typename = void>
+struct has_consolidate : std::false_type
+{
+};
+
+template <typename Allocator>
+struct has_consolidate<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator &>().consolidate())>>
+    : std::true_type
+{
+};
+
+template <typename Allocator, typename = void>
+struct has_reset : std::false_type
+{
+};
+
+template <typename Allocator>
+struct has_reset<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator &>().reset())>>
+    : std::true_type
+{
+};
+
+template <typename Allocator, typename = void>
+struct has_allocate_zeroed : std::false_type
+{
+};
+
+template <typename Allocator>
+struct has_allocate_zeroed<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator &>().allocate_zeroed(
+        std::size_t{}))>> : std::true_type
+{
+};
+
+template <typename Allocator, typename = void>
+struct has_lifetime_hint : std::false_type
+{
+};
+
+template <typename Allocator>
+struct has_lifetime_hint<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator &>().allocate(
+        std::size_t{}, zpp::lifetime::short_lived))>> : std::true_type
+{
+};
+
+template <typename Allocator, typename = void>
+struct has_allocate_near : std::false_type
+{
+};
+
+template <typename Allocator>
+struct has_allocate_near<
+    Allocator,
+    std::void_t<decltype(std::declval<Allocator &>().allocate_near(
+        nullptr, std::size_t{}))>> : std::true_type
+{
+};
+
+template <typename Allocator>
+class model
+{
+public:
+    model(Allocator & allocator, std::size_t alignment) :
+        m_allocator(allocator), m_alignment(alignment)
+    {
+    }
+
+    std::byte * allocate(std::size_t size,
+                         std::uint8_t pattern,
+                         const std::byte * near = nullptr)
+    {
+        auto allocated = m_allocator.allocated();
+        auto pointer = place(size, pattern, near);
+        if (!pointer) {
+            check(m_allocator.allocated() == allocated,
+                  "failed allocation changed allocated()");
+            return nullptr;
+        }
+
+        auto address = reinterpret_cast<std::uintptr_t>(pointer);
+        check(address % m_alignment == 0, "misaligned allocation");
+        check(m_allocator.contains(pointer) &&
+                  m_allocator.contains(pointer + size - 1),
+              "allocation outside of the heap");
+        check(m_allocator.allocation_size(pointer) >= size,
+              "allocation_size() smaller than requested");
+
+        // The block size is the usable size plus a constant overhead.
+        auto block = m_allocator.allocated() - allocated;
+        check(block >= m_allocator.allocation_size(pointer),
+              "allocated() did not grow by the block size");
+        auto overhead = block - m_allocator.allocation_size(pointer);
+        if (!m_overhead_known) {
+            m_overhead = overhead;
+            m_overhead_known = true;
+        }
+        check(overhead == m_overhead, "inconsistent block overhead");
+
+        if (zeroed(pattern, near)) {
+            for (std::size_t i = 0; i < size; ++i) {
+                check(pointer[i] == std::byte{},
+                      "zeroed allocation is not zero");
+            }
+        }
+
+        // No overlap with the neighbouring live allocations.
+        auto next = m_live.lower_bound(pointer);
+        check(next == m_live.end() || pointer + size <= next->first,
+              "allocation overlaps the next allocation");
+        if (next != m_live.begin()) {
+            auto previous = std::prev(next);
+            check(previous->first + previous->second.m_size <= pointer,
+                  "allocation overlaps the previous allocation");
+        }
+
+        std::memset(pointer, pattern, size);
+        m_live.emplace(pointer, allocation{size, pattern});
+        return pointer;
+    }
+
+    void deallocate(std::byte * pointer)
+    {
+        auto entry = m_live.find(pointer);
+        check(entry != m_live.end(), "deallocating unknown pointer");
+        verify(entry->first, entry->second);
+
+        auto allocated = m_allocator.allocated();
+        auto block = m_allocator.allocation_size(pointer) + m_overhead;
+        m_allocator.deallocate(pointer, entry->second.m_size);
+        check(allocated - m_allocator.allocated() == block,
+              "allocated() did not shrink by the block size");
+        m_live.erase(entry);
+    }
+
+    std::byte * reallocate(std::byte * pointer,
+                           std::size_t size,
+                           std::uint8_t pattern)
+    {
+        auto entry = m_live.find(pointer);
+        check(entry != m_live.end(), "reallocating unknown pointer");
+        auto old_size = entry->second.m_size;
+
+        auto result = allocate(size, pattern);
+        if (!result) {
+            return nullptr;
+        }
+        std::memcpy(result, pointer, std::min(size, old_size));
+        m_live[result].m_pattern = entry->second.m_pattern;
+        if (size > old_size) {
+            std::memset(result + old_size, entry->second.m_pattern,
+                        size - old_size);
+        }
+        deallocate(pointer);
+        return result;
+    }
+
+    std::byte * nth(std::size_t index) const
+    {
+        if (m_live.empty()) {
+            return nullptr;
+        }
+        return std::next(m_live.begin(), index % m_live.size())->first;
+    }
+
+    void reset()
+    {
+        if constexpr (has_reset<Allocator>::value) {
+            m_allocator.reset();
+            m_live.clear();
+            check(!m_allocator.allocated(), "allocated() not zero after reset");
+            check(m_allocator.free_nodes() == 1,
+                  "reset did not leave a single node");
+        }
+    }
+
+    void finish()
+    {
+        // Learn the block overhead if nothing was allocated.
+        if (!m_overhead_known) {
+            allocate(1, 0);
+        }
+
+        while (!m_live.empty()) {
+            deallocate(m_live.begin()->first);
+        }
+
+        // Merge any blocks held back from coalescing.
+        if constexpr (has_consolidate<Allocator>::value) {
+            m_allocator.consolidate();
+        }
+
+        check(!m_allocator.allocated(), "allocated() not zero when empty");
+        check(m_allocator.free_nodes() == 1,
+              "heap did not coalesce back to a single node");
+
+        // The single node must be usable as a whole.
+        auto size = m_allocator.largest_free_node() - m_overhead;
+        auto pointer = m_allocator.allocate(size);
+        check(pointer, "heap cannot allocate its single free node");
+        m_allocator.deallocate(pointer, size);
+    }
+
+private:
+    static bool zeroed(std::uint8_t pattern, const std::byte * near)
+    {
+        return has_allocate_zeroed<Allocator>::value && !near &&
+               (pattern & 0x10);
+    }
+
+    std::byte *
+    place(std::size_t size, std::uint8_t pattern, const std::byte * near)
+    {
+        if constexpr (has_allocate_near<Allocator>::value) {
+            if (near) {
+                return m_allocator.allocate_near(near, size);
+            }
+        }
+        if constexpr (has_lifetime_hint<Allocator>::value) {
+            auto hint = pattern & 0x4 ? zpp::lifetime::short_lived
+                                      : zpp::lifetime::long_lived;
+            if constexpr (has_allocate_zeroed<Allocator>::value) {
+                if (zeroed(pattern, near)) {
+                    return m_allocator.allocate_zeroed(size, hint);
+                }
+            }
+            return m_allocator.allocate(size, hint);
+        }
+        return m_allocator.allocate(size);
+    }
+
+    void verify(const std::byte * pointer, const allocation & allocation)
+    {
+        for (std::size_t i = 0; i < allocation.m_size; ++i) {
+            check(pointer[i] == std::byte{allocation.m_pattern},
+                  "allocation contents clobbered");
+        }
+    }
+
+    Allocator & m_allocator;
+    std::size_t m_alignment{};
+    std::size_t m_overhead{};
+    bool m_overhead_known{};
+    std::map<std::byte *, allocation> m_live;
+};
+
+template <typename Allocator>
+void run(const std::uint8_t * data,
+         std::size_t size,
+         std::size_t alignment)
+{
+    input input(data, size);
+
+    // Exercise the alignment of the region start as well.
+    static auto memory = std::make_unique<std::byte[]>(heap_size + 64);
+    auto start = input.byte();
+    auto region = memory.get() + start % 64;
+
+    // Sometimes over zero filled memory that the heap knows about.
+    auto create = [&]() -> Allocator {
+        if constexpr (std::is_constructible_v<Allocator,
+                                              std::byte *,
+                                              std::size_t,
+                                              zpp::zero_filled>) {
+            if (start & 0x40) {
+                std::memset(region, 0, heap_size);
+                return Allocator(region, heap_size, zpp::zero_filled{});
+            }
+        }
+        return Allocator(region, heap_size);
+    };
+    Allocator allocator = create();
+    model<Allocator> model(allocator, alignment);
+
+    for (std::size_t i = 0; i < max_operations && !input.empty(); ++i) {
+        auto operation = input.byte();
+        switch (operation % 4) {
+        case 0:
+        case 1:
+            // Sometimes near a live allocation.
+            model.allocate(input.size(),
+                           operation,
+                           operation & 0x8 ? model.nth(input.byte())
+                                           : nullptr);
+            break;
+        case 2:
+            // Rarely free everything at once.
+            if (operation >= 0xf0) {
+                model.reset();
+            } else if (auto pointer = model.nth(input.byte())) {
+                model.deallocate(pointer);
+            }
+            break;
+        case 3:
+            if (auto pointer = model.nth(input.byte())) {
+                model.reallocate(pointer, input.size(), operation);
+            }
+            break;
+        }
+    }
+
+    model.finish();
+}
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t * data,
+                                      std::size_t size)
+{
+    run<zpp::allocator<std::byte>>(data, size, alignof(std::max_align_t));
+    run<zpp::allocator<std::byte, 8>>(data, size, 8);
+    run<zpp::allocator<std::byte, 64>>(data, size, 64);
+    run<zpp::basic_allocator<zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_allocator<zpp::offset_links, 8>>(data, size, 8);
+    run<zpp::basic_heap<zpp::best_fit>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::basic_best_fit<true>, zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::next_fit>>(data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::fast_bins<zpp::first_fit>>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::deferred_coalescing<zpp::best_fit>>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<
+        zpp::deferred_coalescing<zpp::fast_bins<zpp::next_fit>, 1>,
+        zpp::offset_links>>(data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::fast_bins<zpp::tail_split<zpp::segregated_fit<>>,
+                                       512>,
+                        zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::tail_split<zpp::next_fit>, zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::segregated_fit<>, zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::first_fit, zpp::pointer_links, zpp::spin_lock>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::tail_split<zpp::first_fit>>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::tail_split<zpp::segregated_fit<>>,
+                        zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::indexed_fit<16>>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::basic_heap<zpp::tail_split<zpp::indexed_fit<>>,
+                        zpp::offset_links>>(
+        data, size, alignof(std::max_align_t));
+    run<zpp::out_of_band_heap<>>(data, size, alignof(std::max_align_t));
+    run<zpp::out_of_band_heap<8>>(data, size, 8);
+    return 0;
+}
+
+#ifdef ZPP_FUZZ_STANDALONE
+int main(int argc, char ** argv)
+{
+    std::vector<std::uint8_t> data;
+
+    if (argc > 1) {
+        for (int i = 1; i < argc; ++i) {
+            auto file = std::fopen(argv[i], "rb");
+            if (!file) {
+                std::fprintf(stderr, "cannot open %s\n", argv[i]);
+                return 2;
+            }
+            data.clear();
+            for (int c; (c = std::fgetc(file)) != EOF;) {
+                data.push_back(static_cast<std::uint8_t>(c));
+            }
+            std::fclose(file);
+            LLVMFuzzerTestOneInput(data.data(), data.size());
+        }
+        return 0;
+    }
+
+    std::srand(0);
+    for (int i = 0; i < 2000; ++i) {
+        data.resize(std::rand() % 8192);
+        for (auto & byte : data) {
+            byte = static_cast<std::uint8_t>(std::rand());
+        }
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,88 @@
+// Placement tests of allocate_near.
+//
+// Checks, for every header layout and alignment, that a block allocated
+// near a hint takes a free neighbour of the hint rather than the first
+// fitting node, and that hints which are not aligned as block data fall
+// back to a regular allocation without trusting the block contents.
+//
+// Usage: allocate_near
+#include "../zpp_allocator.h"
+#include "check.h"
+#include <cstring>
+#include <memory>
+
+namespace
+{
+constexpr std::size_t heap_size = 64 * 1024;
+constexpr std::size_t count = 40;
+constexpr std::size_t size = 64;
+
+template <typename Heap>
+void test()
+{
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    Heap heap(memory.get(), heap_size);
+
+    std::byte * blocks[count]{};
+    for (auto & block : blocks) {
+        block = heap.allocate(size);
+        ZPP_CHECK(block);
+    }
+
+    // A free node far away and one next to the hint.
+    heap.deallocate(blocks[2], size);
+    heap.deallocate(blocks[30], size);
+    ZPP_CHECK(heap.allocate_near(blocks[29], size) == blocks[30]);
+
+    // The node before the hint as well.
+    heap.deallocate(blocks[30], size);
+    ZPP_CHECK(heap.allocate_near(blocks[31], size) == blocks[30]);
+
+    // Addresses inside of a block that are not aligned as block data are
+    // not taken for headers, even if the block holds values that look like
+    // a list of headers.
+    constexpr std::size_t block_size = 256;
+    auto block = heap.allocate(block_size);
+    ZPP_CHECK(block);
+    std::uint32_t fake[][2] = {{0, 16}, {2, 64}, {8, 17}};
+    std::memcpy(block + 24, fake[0], sizeof(fake[0]));
+    std::memcpy(block + 40, fake[1], sizeof(fake[1]));
+    std::memcpy(block + 104, fake[2], sizeof(fake[2]));
+    for (std::size_t offset = 1; offset < block_size; ++offset) {
+        if (!(offset % 8)) {
+            continue;
+        }
+        auto pointer = heap.allocate_near(block + offset, 8);
+        ZPP_CHECK(pointer);
+        ZPP_CHECK(pointer + 8 <= block || block + block_size <= pointer);
+        heap.deallocate(pointer, 8);
+    }
+    heap.deallocate(block, block_size);
+
+    // Without a block to go near, the first fit is used.
+    ZPP_CHECK(heap.allocate_near(blocks[20] + 1, size) == blocks[2]);
+
+    for (std::size_t i = 3; i < count; ++i) {
+        heap.deallocate(blocks[i], size);
+    }
+    heap.deallocate(blocks[0], size);
+    heap.deallocate(blocks[1], size);
+    heap.deallocate(blocks[2], size);
+    ZPP_CHECK(!heap.allocated());
+}
+} // namespace
+
+int main()
+{
+    test<zpp::allocator<std::byte>>();
+    test<zpp::basic_allocator<zpp::pointer_links, 8>>();
+    test<zpp::basic_allocator<zpp::offset_links>>();
+    test<zpp::basic_allocator<zpp::offset_links, 8>>();
+    test<zpp::basic_heap<zpp::first_fit,
+                         zpp::pointer_links,
+                         zpp::no_lock,
+                         zpp::basic_stats,
+                         64>>();
+    std::printf("allocate_near ok\n");
+    return 0;
+}
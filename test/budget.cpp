@@ -0,0 +1,187 @@
+// Budget tests.
+//
+// Checks that the unused reservations of other threads neither refuse
+// allocations below the hard limit nor call the watermark handler before
+// the allocated bytes reach the soft limit, and that threads racing for a
+// budget fill it exactly to the hard limit and call the handler once.
+//
+// Usage: budget
+#include "../zpp_allocator.h"
+#include "check.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t kib = 1024;
+constexpr std::size_t threads = 4;
+
+struct idle_refusal;
+struct idle_watermark;
+struct racing_refusal;
+struct racing_watermark;
+struct allocations;
+
+std::atomic<std::size_t> watermark_calls{};
+std::atomic<std::size_t> watermark_allocated{};
+
+void on_watermark(std::size_t allocated)
+{
+    ++watermark_calls;
+    watermark_allocated = allocated;
+}
+
+// Runs the test while another thread holds an unused reservation of the
+// budget, made by allocating and freeing a single byte.
+template <typename Tag, typename Test>
+void with_idle_reservation(Test test)
+{
+    std::atomic<bool> reserved{};
+    std::atomic<bool> done{};
+    std::thread idle([&] {
+        ZPP_CHECK(zpp::budget<Tag>::acquire(1));
+        zpp::budget<Tag>::release(1);
+        reserved = true;
+        while (!done) {
+            std::this_thread::yield();
+        }
+    });
+    while (!reserved) {
+        std::this_thread::yield();
+    }
+    ZPP_CHECK(zpp::budget<Tag>::reserved() > 1);
+    ZPP_CHECK(zpp::budget<Tag>::allocated() == 0);
+
+    test();
+
+    done = true;
+    idle.join();
+}
+
+void test_idle_refusal()
+{
+    using budget = zpp::budget<idle_refusal>;
+    budget::set_limits(~std::size_t{}, 100 * kib);
+    with_idle_reservation<idle_refusal>([] {
+        // Fits with the reservation of the idle thread taken back.
+        ZPP_CHECK(budget::acquire(40 * kib));
+        ZPP_CHECK(budget::acquire(60 * kib));
+        ZPP_CHECK(budget::allocated() == 100 * kib);
+        ZPP_CHECK(budget::reserved() <= 100 * kib);
+
+        // Past the hard limit.
+        ZPP_CHECK(!budget::acquire(1));
+        budget::release(1 * kib);
+        ZPP_CHECK(budget::acquire(1 * kib));
+        ZPP_CHECK(!budget::acquire(1));
+
+        budget::release(100 * kib);
+        ZPP_CHECK(budget::allocated() == 0);
+    });
+}
+
+void test_idle_watermark()
+{
+    using budget = zpp::budget<idle_watermark>;
+    budget::set_limits(100 * kib, ~std::size_t{});
+    budget::set_watermark_handler(on_watermark);
+    watermark_calls = 0;
+    with_idle_reservation<idle_watermark>([] {
+        // The handler is called by the allocation that reaches the soft
+        // limit, not by the reservations.
+        for (std::size_t allocated = 0; allocated < 99 * kib;
+             allocated += kib) {
+            ZPP_CHECK(budget::acquire(kib));
+            ZPP_CHECK(watermark_calls == 0);
+        }
+        ZPP_CHECK(budget::acquire(kib));
+        ZPP_CHECK(watermark_calls == 1);
+        ZPP_CHECK(watermark_allocated == 100 * kib);
+        ZPP_CHECK(budget::acquire(kib));
+        ZPP_CHECK(watermark_calls == 1);
+        budget::release(101 * kib);
+    });
+    budget::set_watermark_handler(nullptr);
+}
+
+// Every thread allocates chunks until it is refused, and frees them once
+// all threads are refused. Returns the bytes allocated by all threads.
+template <typename Tag>
+std::size_t race(std::size_t chunk)
+{
+    std::atomic<std::size_t> total{};
+    std::atomic<std::size_t> refused{};
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < threads; ++i) {
+        workers.emplace_back([&] {
+            std::size_t allocated{};
+            while (zpp::budget<Tag>::acquire(chunk)) {
+                allocated += chunk;
+            }
+            total += allocated;
+            ++refused;
+            while (refused != threads) {
+                std::this_thread::yield();
+            }
+            zpp::budget<Tag>::release(allocated);
+        });
+    }
+    for (auto & worker : workers) {
+        worker.join();
+    }
+    return total;
+}
+
+void test_racing_refusal()
+{
+    using budget = zpp::budget<racing_refusal>;
+    budget::set_limits(~std::size_t{}, 1024 * kib);
+
+    // Chunks divide every reservation, so nothing is left unused.
+    ZPP_CHECK(race<racing_refusal>(kib) == 1024 * kib);
+    ZPP_CHECK(budget::allocated() == 0);
+    ZPP_CHECK(budget::reserved() == 0);
+}
+
+void test_racing_watermark()
+{
+    using budget = zpp::budget<racing_watermark>;
+    budget::set_limits(512 * kib, 1024 * kib);
+    budget::set_watermark_handler(on_watermark);
+    watermark_calls = 0;
+    ZPP_CHECK(race<racing_watermark>(kib) == 1024 * kib);
+    ZPP_CHECK(watermark_calls == 1);
+    ZPP_CHECK(watermark_allocated >= 512 * kib);
+    budget::set_watermark_handler(nullptr);
+}
+
+void test_allocator()
+{
+    constexpr std::size_t heap_size = 256 * kib;
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    zpp::heap<>::create(memory.get(), heap_size);
+    zpp::budget<allocations>::set_limits(~std::size_t{}, 64 * kib);
+
+    zpp::budgeted_allocator<char, allocations> allocator;
+    auto pointer = allocator.allocate(32 * kib);
+    ZPP_CHECK(pointer);
+    ZPP_CHECK(!allocator.allocate(33 * kib));
+    ZPP_CHECK(zpp::heap<>::get_allocator().allocated() > 32 * kib);
+    allocator.deallocate(pointer, 32 * kib);
+    ZPP_CHECK(!zpp::heap<>::get_allocator().allocated());
+    ZPP_CHECK(zpp::budget<allocations>::allocated() == 0);
+}
+} // namespace
+
+int main()
+{
+    test_idle_refusal();
+    test_idle_watermark();
+    test_racing_refusal();
+    test_racing_watermark();
+    test_allocator();
+    std::printf("budget ok\n");
+    return 0;
+}
@@ -0,0 +1,209 @@
+// Building block tests.
+//
+// Round trips allocations of fallback, segregator, bucketizer and affix
+// sources through zpp::static_allocator and standard containers, and
+// checks that every block is served by the expected source and returned
+// to it.
+//
+// Usage: building_blocks
+#include "../zpp_allocator.h"
+#include "check.h"
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t heap_size = 64 * 1024;
+
+template <std::size_t Index>
+using bucket = zpp::heap<20 + Index>;
+
+using primary = zpp::heap<1>;
+using secondary = zpp::heap<2>;
+using small = zpp::heap<3>;
+using large = zpp::heap<4>;
+using affixed = zpp::heap<5>;
+
+constexpr std::uint32_t prefix_magic = 0x70726566;
+constexpr std::uint32_t suffix_magic = 0x73756666;
+
+struct prefix
+{
+    ~prefix()
+    {
+        ++destroyed;
+    }
+
+    std::uint32_t m_magic = prefix_magic;
+    inline static std::size_t destroyed{};
+};
+
+struct suffix
+{
+    ~suffix()
+    {
+        ++destroyed;
+    }
+
+    std::uint32_t m_magic = suffix_magic;
+    inline static std::size_t destroyed{};
+};
+
+void test_fallback()
+{
+    using source = zpp::fallback<primary, secondary>;
+    std::vector<int, zpp::static_allocator<int, source>> values;
+
+    // Grow past what the primary heap can hold in one block.
+    for (int i = 0; i < 5000; ++i) {
+        values.push_back(i);
+    }
+    ZPP_CHECK(secondary::get_allocator().contains(values.data()));
+    ZPP_CHECK(source::get_allocator().contains(values.data()));
+    for (int i = 0; i < 5000; ++i) {
+        ZPP_CHECK(values[i] == i);
+    }
+
+    // Small blocks come from the primary heap while it has room.
+    zpp::static_allocator<char, source> allocator;
+    auto pointer = allocator.allocate(100);
+    ZPP_CHECK(primary::get_allocator().contains(pointer));
+    ZPP_CHECK(source::get_allocator().allocation_size(pointer) >= 100);
+    allocator.deallocate(pointer, 100);
+
+    values.clear();
+    values.shrink_to_fit();
+    ZPP_CHECK(!primary::get_allocator().allocated());
+    ZPP_CHECK(!secondary::get_allocator().allocated());
+}
+
+void test_segregator()
+{
+    using source = zpp::segregator<64, small, large>;
+    zpp::static_allocator<char, source> allocator;
+
+    std::vector<std::pair<char *, std::size_t>> blocks;
+    for (std::size_t size = 1; size <= 256; ++size) {
+        auto pointer = allocator.allocate(size);
+        ZPP_CHECK(pointer);
+        ZPP_CHECK(size <= 64 ? small::get_allocator().contains(pointer)
+                             : large::get_allocator().contains(pointer));
+        ZPP_CHECK(source::get_allocator().allocation_size(pointer) >= size);
+        std::memset(pointer, int(size), size);
+        blocks.emplace_back(pointer, size);
+    }
+    for (auto [pointer, size] : blocks) {
+        for (std::size_t i = 0; i < size; ++i) {
+            ZPP_CHECK(pointer[i] == char(size));
+        }
+        allocator.deallocate(pointer, size);
+    }
+    ZPP_CHECK(!small::get_allocator().allocated());
+    ZPP_CHECK(!large::get_allocator().allocated());
+}
+
+void test_bucketizer()
+{
+    using source = zpp::bucketizer<bucket, 0, 256, 64>;
+    static_assert(source::buckets == 4);
+    zpp::static_allocator<char, source> allocator;
+
+    std::vector<std::pair<char *, std::size_t>> blocks;
+    for (std::size_t size = 1; size <= 256; ++size) {
+        auto pointer = allocator.allocate(size);
+        ZPP_CHECK(pointer);
+        ZPP_CHECK(source::get_allocator().contains(pointer));
+        ZPP_CHECK(source::get_allocator().allocation_size(pointer) >= size);
+        auto index = (size - 1) / 64;
+        ZPP_CHECK(index != 0 || bucket<0>::get_allocator().contains(pointer));
+        ZPP_CHECK(index != 1 || bucket<1>::get_allocator().contains(pointer));
+        ZPP_CHECK(index != 2 || bucket<2>::get_allocator().contains(pointer));
+        ZPP_CHECK(index != 3 || bucket<3>::get_allocator().contains(pointer));
+        std::memset(pointer, int(size), size);
+        blocks.emplace_back(pointer, size);
+    }
+
+    // Sizes outside of the buckets are not served.
+    ZPP_CHECK(!source::get_allocator().allocate(0));
+    ZPP_CHECK(!source::get_allocator().allocate(257));
+
+    for (auto [pointer, size] : blocks) {
+        for (std::size_t i = 0; i < size; ++i) {
+            ZPP_CHECK(pointer[i] == char(size));
+        }
+        allocator.deallocate(pointer, size);
+    }
+    ZPP_CHECK(!bucket<0>::get_allocator().allocated());
+    ZPP_CHECK(!bucket<1>::get_allocator().allocated());
+    ZPP_CHECK(!bucket<2>::get_allocator().allocated());
+    ZPP_CHECK(!bucket<3>::get_allocator().allocated());
+}
+
+void test_affix()
+{
+    using source = zpp::affix<affixed, prefix, suffix>;
+    zpp::static_allocator<char, source> allocator;
+
+    std::vector<std::pair<char *, std::size_t>> blocks;
+    for (std::size_t size = 1; size <= 200; size += 7) {
+        auto pointer = allocator.allocate(size);
+        ZPP_CHECK(pointer);
+        ZPP_CHECK(reinterpret_cast<std::uintptr_t>(pointer) %
+                      alignof(std::max_align_t) ==
+                  0);
+        auto bytes = reinterpret_cast<std::byte *>(pointer);
+        ZPP_CHECK(source::prefix(bytes).m_magic == prefix_magic);
+        ZPP_CHECK(source::suffix(bytes, size).m_magic == suffix_magic);
+        ZPP_CHECK(reinterpret_cast<std::uintptr_t>(
+                      &source::suffix(bytes, size)) %
+                      alignof(suffix) ==
+                  0);
+        std::memset(pointer, 0xff, size);
+        blocks.emplace_back(pointer, size);
+    }
+
+    // Filling the data leaves the prefix and suffix intact.
+    for (auto [pointer, size] : blocks) {
+        auto bytes = reinterpret_cast<std::byte *>(pointer);
+        ZPP_CHECK(source::prefix(bytes).m_magic == prefix_magic);
+        ZPP_CHECK(source::suffix(bytes, size).m_magic == suffix_magic);
+        allocator.deallocate(pointer, size);
+    }
+    ZPP_CHECK(prefix::destroyed == blocks.size());
+    ZPP_CHECK(suffix::destroyed == blocks.size());
+    ZPP_CHECK(!affixed::get_allocator().allocated());
+
+    // Without a suffix the usable size follows the source.
+    using prefixed = zpp::affix<affixed, prefix>;
+    zpp::static_allocator<char, prefixed> prefix_allocator;
+    auto pointer = prefix_allocator.allocate(100);
+    ZPP_CHECK(prefixed::get_allocator().allocation_size(pointer) >= 100);
+    prefix_allocator.deallocate(pointer, 100);
+    ZPP_CHECK(!affixed::get_allocator().allocated());
+}
+} // namespace
+
+int main()
+{
+    auto memory = std::make_unique<std::byte[]>(12 * heap_size);
+    auto region = [&](std::size_t index) {
+        return memory.get() + index * heap_size;
+    };
+    primary::create(region(0), heap_size / 16);
+    secondary::create(region(1), heap_size);
+    small::create(region(2), heap_size);
+    large::create(region(3), heap_size);
+    affixed::create(region(4), heap_size);
+    bucket<0>::create(region(5), heap_size);
+    bucket<1>::create(region(6), heap_size);
+    bucket<2>::create(region(7), heap_size);
+    bucket<3>::create(region(8), heap_size);
+
+    test_fallback();
+    test_segregator();
+    test_bucketizer();
+    test_affix();
+    std::printf("building blocks ok\n");
+    return 0;
+}
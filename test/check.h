@@ -0,0 +1,19 @@
+#ifndef ZPP_TEST_CHECK_H
+#define ZPP_TEST_CHECK_H
+#include <cstdio>
+#include <cstdlib>
+
+// Aborts with the location and the failed condition.
+#define ZPP_CHECK(condition)                                                 \
+    do {                                                                     \
+        if (!(condition)) {                                                  \
+            std::fprintf(stderr,                                             \
+                         "%s:%d: check failed: %s\n",                        \
+                         __FILE__,                                           \
+                         __LINE__,                                           \
+                         #condition);                                        \
+            std::abort();                                                    \
+        }                                                                    \
+    } while (false)
+
+#endif
@@ -0,0 +1,105 @@
+// Failure handler tests.
+//
+// Checks that a failure handler receives its context, that a handler that
+// frees memory of the heap, as a cache evicting entries, makes the retried
+// allocation succeed, and that a handler that gives up fails the
+// allocation after a single call.
+//
+// Usage: failure_handler
+#include "../zpp_allocator.h"
+#include "check.h"
+#include <memory>
+#include <vector>
+
+namespace
+{
+constexpr std::size_t heap_size = 64 * 1024;
+constexpr std::size_t entry_size = 4096;
+
+template <typename Heap>
+struct cache
+{
+    bool evict_some(std::size_t)
+    {
+        ++m_calls;
+        if (m_entries.empty()) {
+            return false;
+        }
+        m_heap->deallocate(m_entries.back(), entry_size);
+        m_entries.pop_back();
+        return true;
+    }
+
+    const Heap * m_heap{};
+    std::vector<std::byte *> m_entries;
+    std::size_t m_calls{};
+};
+
+template <typename Heap>
+bool evict(void * context, std::size_t size)
+{
+    return static_cast<cache<Heap> *>(context)->evict_some(size);
+}
+
+bool give_up(void * context, std::size_t)
+{
+    ++*static_cast<std::size_t *>(context);
+    return false;
+}
+
+template <typename Heap>
+void test()
+{
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    Heap heap(memory.get(), heap_size);
+
+    // The cache grows into everything the heap has.
+    cache<Heap> entries;
+    entries.m_heap = &heap;
+    while (auto entry = heap.allocate(entry_size)) {
+        entries.m_entries.push_back(entry);
+    }
+    auto cached = entries.m_entries.size();
+    ZPP_CHECK(cached > 1);
+
+    // Without a handler the allocation fails.
+    ZPP_CHECK(!heap.allocate(2 * entry_size));
+
+    // Evicting entries makes room, the handler is called without the
+    // lock held, so that it can free memory of the heap.
+    heap.set_failure_handler(evict<Heap>, &entries);
+    auto pointer = heap.allocate(2 * entry_size);
+    ZPP_CHECK(pointer);
+    ZPP_CHECK(entries.m_calls >= 1);
+    ZPP_CHECK(entries.m_entries.size() < cached);
+    ZPP_CHECK(entries.m_calls == cached - entries.m_entries.size());
+
+    // Once the cache is empty the handler gives up.
+    entries.m_calls = 0;
+    auto remaining = entries.m_entries.size();
+    ZPP_CHECK(!heap.allocate(heap_size));
+    ZPP_CHECK(entries.m_entries.empty());
+    ZPP_CHECK(entries.m_calls == remaining + 1);
+    heap.deallocate(pointer, 2 * entry_size);
+    ZPP_CHECK(!heap.allocated());
+
+    // A handler that gives up is called once per failed allocation.
+    std::size_t calls{};
+    heap.set_failure_handler(give_up, &calls);
+    ZPP_CHECK(!heap.allocate(heap_size));
+    ZPP_CHECK(calls == 1);
+
+    // Clearing the handler fails without calling it.
+    heap.set_failure_handler(nullptr);
+    ZPP_CHECK(!heap.allocate(heap_size));
+    ZPP_CHECK(calls == 1);
+}
+} // namespace
+
+int main()
+{
+    test<zpp::allocator<std::byte>>();
+    test<zpp::basic_heap<zpp::best_fit, zpp::offset_links, zpp::spin_lock>>();
+    std::printf("failure handler ok\n");
+    return 0;
+}
@@ -0,0 +1,215 @@
+// Registry tests.
+//
+// Checks that registered heaps are found by pointers into them, also when
+// two heaps share a granule or heaps are nested in the memory of others,
+// that zpp::free returns blocks to the heap that owns them, that removed
+// heaps are no longer found, that partially overlapping heaps are
+// rejected, and that lookups run while other heaps come and go.
+//
+// Usage: registry
+#include "../zpp_allocator.h"
+#include "check.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+
+namespace
+{
+using heap = zpp::allocator<std::byte>;
+
+constexpr std::size_t granule = 64 * 1024;
+
+// Memory that starts at a granule boundary.
+std::byte * granules(std::unique_ptr<std::byte[]> & memory, std::size_t count)
+{
+    memory = std::make_unique<std::byte[]>((count + 1) * granule);
+    auto address = reinterpret_cast<std::uintptr_t>(memory.get());
+    return memory.get() + (granule - address % granule) % granule;
+}
+
+void test_separate()
+{
+    std::unique_ptr<std::byte[]> memory;
+    auto region = granules(memory, 4);
+    heap first(region, 2 * granule);
+    heap second(region + 2 * granule, 2 * granule);
+    ZPP_CHECK(zpp::registry::add(first, region, 2 * granule));
+    ZPP_CHECK(zpp::registry::add(second, region + 2 * granule, 2 * granule));
+
+    auto a = first.allocate(100);
+    auto b = second.allocate(100);
+    ZPP_CHECK(zpp::registry::owner(a) == &first);
+    ZPP_CHECK(zpp::registry::owner(b) == &second);
+    ZPP_CHECK(!zpp::registry::owner(region + 4 * granule));
+
+    ZPP_CHECK(zpp::free(a));
+    ZPP_CHECK(zpp::free(b));
+    ZPP_CHECK(!first.allocated());
+    ZPP_CHECK(!second.allocated());
+
+    // Removed heaps are not found.
+    zpp::registry::remove(&first);
+    a = first.allocate(100);
+    ZPP_CHECK(!zpp::registry::owner(a));
+    ZPP_CHECK(!zpp::free(a));
+    first.deallocate(a, 100);
+    zpp::registry::remove(&second);
+    ZPP_CHECK(!zpp::registry::owner(b));
+}
+
+void test_shared_granule()
+{
+    // Two heaps in the halves of one granule.
+    std::unique_ptr<std::byte[]> memory;
+    auto region = granules(memory, 1);
+    heap first(region, granule / 2);
+    heap second(region + granule / 2, granule / 2);
+    ZPP_CHECK(zpp::registry::add(first, region, granule / 2));
+    ZPP_CHECK(zpp::registry::add(second, region + granule / 2, granule / 2));
+
+    auto a = first.allocate(100);
+    auto b = second.allocate(100);
+    ZPP_CHECK(zpp::registry::owner(a) == &first);
+    ZPP_CHECK(zpp::registry::owner(b) == &second);
+    ZPP_CHECK(zpp::free(b));
+    ZPP_CHECK(!second.allocated());
+
+    // Once the second heap is removed the granule is the first heap's.
+    zpp::registry::remove(&second);
+    ZPP_CHECK(zpp::registry::owner(a) == &first);
+    ZPP_CHECK(!zpp::registry::owner(region + granule / 2));
+    ZPP_CHECK(zpp::free(a));
+    ZPP_CHECK(!first.allocated());
+    zpp::registry::remove(&first);
+}
+
+void test_nested()
+{
+    std::unique_ptr<std::byte[]> memory;
+    auto region = granules(memory, 4);
+    heap parent(region, 4 * granule);
+    ZPP_CHECK(zpp::registry::add(parent, region, 4 * granule));
+
+    // A child heap over a block of the parent, as a sub-heap.
+    auto block = parent.allocate(granule);
+    heap child(block, granule);
+    ZPP_CHECK(zpp::registry::add(child, block, granule));
+
+    auto inner = child.allocate(100);
+    auto outer = parent.allocate(100);
+    ZPP_CHECK(zpp::registry::owner(inner) == &child);
+    ZPP_CHECK(zpp::registry::owner(outer) == &parent);
+    ZPP_CHECK(zpp::free(inner));
+    ZPP_CHECK(!child.allocated());
+    ZPP_CHECK(zpp::free(outer));
+
+    // Ranges that overlap without nesting, or repeat, are rejected.
+    auto other_memory = std::make_unique<std::byte[]>(granule);
+    heap other(other_memory.get(), granule);
+    ZPP_CHECK(!zpp::registry::add(other, block - granule / 2, granule));
+    ZPP_CHECK(!zpp::registry::add(other, block, granule));
+    ZPP_CHECK(!zpp::registry::add(other, region + 2 * granule, 4 * granule));
+
+    // Without the child its block belongs to the parent.
+    zpp::registry::remove(&child);
+    ZPP_CHECK(zpp::registry::owner(inner) == &parent);
+    ZPP_CHECK(zpp::free(block));
+    ZPP_CHECK(!parent.allocated());
+    zpp::registry::remove(&parent);
+}
+
+// The innermost of the ranges that contain the address, in the order of
+// nesting, or null.
+const heap * innermost(std::byte * address,
+                       std::byte * const (&ranges)[3][2],
+                       const heap * const (&heaps)[3])
+{
+    const heap * owner{};
+    for (std::size_t i = 0; i < 3; ++i) {
+        if (heaps[i] && ranges[i][0] <= address && address < ranges[i][1]) {
+            owner = heaps[i];
+        }
+    }
+    return owner;
+}
+
+void test_nested_granules()
+{
+    // A child that ends inside of granules of its parent, and a
+    // grandchild that covers granules of the child whole.
+    std::unique_ptr<std::byte[]> memory;
+    auto region = granules(memory, 8);
+    std::byte * const ranges[3][2] = {
+        {region, region + 8 * granule},
+        {region + granule / 2, region + 5 * granule + granule / 2},
+        {region + 2 * granule, region + 4 * granule},
+    };
+    heap parent(ranges[0][0], ranges[0][1] - ranges[0][0]);
+    heap child(ranges[1][0], ranges[1][1] - ranges[1][0]);
+    heap grandchild(ranges[2][0], ranges[2][1] - ranges[2][0]);
+    const heap * heaps[3] = {&parent, &child, &grandchild};
+    for (std::size_t i = 0; i < 3; ++i) {
+        ZPP_CHECK(zpp::registry::add(
+            *heaps[i], ranges[i][0], ranges[i][1] - ranges[i][0]));
+    }
+
+    // Pointers at both ends of every quarter granule, and so at the ends
+    // of the ranges, are owned by the innermost range that contains them,
+    // also as the heaps are removed inside out.
+    for (std::size_t removed = 0; removed <= 3; ++removed) {
+        for (auto address = region; address < region + 8 * granule;
+             address += granule / 4) {
+            for (auto pointer : {address, address + granule / 4 - 1}) {
+                ZPP_CHECK(zpp::registry::owner(pointer) ==
+                          innermost(pointer, ranges, heaps));
+            }
+        }
+        if (removed < 3) {
+            zpp::registry::remove(heaps[2 - removed]);
+            heaps[2 - removed] = nullptr;
+        }
+    }
+}
+
+void test_concurrent()
+{
+    std::unique_ptr<std::byte[]> memory;
+    auto region = granules(memory, 1);
+    heap first(region, granule / 2);
+    heap second(region + granule / 2, granule / 2);
+    ZPP_CHECK(zpp::registry::add(first, region, granule / 2));
+    auto pointer = first.allocate(100);
+
+    // Another heap in the same granule comes and goes.
+    std::atomic<bool> done{};
+    std::thread churn([&] {
+        while (!done) {
+            ZPP_CHECK(zpp::registry::add(
+                second, region + granule / 2, granule / 2));
+            zpp::registry::remove(&second);
+        }
+    });
+    for (int i = 0; i < 100000; ++i) {
+        ZPP_CHECK(zpp::registry::owner(pointer) == &first);
+        auto owner = zpp::registry::owner(region + granule / 2);
+        ZPP_CHECK(!owner || owner == &second);
+    }
+    done = true;
+    churn.join();
+
+    ZPP_CHECK(zpp::free(pointer));
+    ZPP_CHECK(!first.allocated());
+    zpp::registry::remove(&first);
+}
+} // namespace
+
+int main()
+{
+    test_separate();
+    test_shared_granule();
+    test_nested();
+    test_nested_granules();
+    test_concurrent();
+    std::printf("registry ok\n");
+    return 0;
+}
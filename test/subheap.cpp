@@ -0,0 +1,113 @@
+// Sub-heap tests.
+//
+// Checks that a sub-heap is carved out of one block of its parent, that
+// moving it transfers the block, that destroying it returns exactly that
+// block with everything still allocated from it, that it is empty when
+// the parent cannot allocate the block, and that tiny sub-heaps are valid.
+//
+// Usage: subheap
+#include "../zpp_allocator.h"
+#include "check.h"
+#include <memory>
+#include <utility>
+
+namespace
+{
+constexpr std::size_t heap_size = 256 * 1024;
+constexpr std::size_t child_size = 64 * 1024;
+
+template <typename Heap>
+void test()
+{
+    auto memory = std::make_unique<std::byte[]>(heap_size);
+    Heap parent(memory.get(), heap_size);
+    auto before = parent.allocated();
+    auto free_nodes = parent.free_nodes();
+
+    {
+        auto child = parent.make_subheap(child_size);
+        ZPP_CHECK(child);
+
+        // The parent gave away exactly one block.
+        auto block = parent.allocated() - before;
+        ZPP_CHECK(block >= child_size);
+        ZPP_CHECK(child->size() <= block);
+        ZPP_CHECK(child->size() + 64 >= child_size);
+
+        // Child allocations come from within that block.
+        std::byte * pointers[16]{};
+        for (auto & pointer : pointers) {
+            pointer = child->allocate(1000);
+            ZPP_CHECK(pointer);
+            ZPP_CHECK(child->contains(pointer));
+            ZPP_CHECK(parent.contains(pointer));
+        }
+        ZPP_CHECK(parent.allocated() - before == block);
+
+        // Moving transfers the child and its allocations.
+        auto moved = std::move(child);
+        ZPP_CHECK(moved);
+        ZPP_CHECK(!child);
+        ZPP_CHECK(moved->contains(pointers[0]));
+        moved->deallocate(pointers[0], 1000);
+        ZPP_CHECK(moved->allocate(1000) == pointers[0]);
+        ZPP_CHECK(parent.allocated() - before == block);
+    }
+
+    // Destruction returns the block with whatever was left allocated.
+    // Blocks held back from coalescing are merged first.
+    ZPP_CHECK(parent.allocated() == before);
+    parent.consolidate();
+    ZPP_CHECK(parent.free_nodes() == free_nodes);
+    ZPP_CHECK(parent.largest_free_node() + 64 >= heap_size);
+
+    // A parent that cannot allocate the block gives an empty child.
+    auto filler = parent.allocate(heap_size - child_size / 2);
+    ZPP_CHECK(filler);
+    {
+        auto child = parent.make_subheap(child_size);
+        ZPP_CHECK(!child);
+        auto moved = std::move(child);
+        ZPP_CHECK(!moved);
+    }
+    parent.deallocate(filler, heap_size - child_size / 2);
+    ZPP_CHECK(parent.allocated() == before);
+
+    // Sub-heaps nest.
+    {
+        auto child = parent.make_subheap(child_size);
+        ZPP_CHECK(child);
+        auto grandchild = child->make_subheap(child_size / 4);
+        ZPP_CHECK(grandchild);
+        ZPP_CHECK(child->contains(grandchild->allocate(100)));
+        ZPP_CHECK(child->allocated() >= child_size / 4);
+    }
+    ZPP_CHECK(parent.allocated() == before);
+
+    // Sub-heaps too small for a block still hold a valid child heap.
+    for (std::size_t size = 0; size <= 64; size += 4) {
+        {
+            auto child = parent.make_subheap(size);
+            ZPP_CHECK(child);
+            if (auto pointer = child->allocate(1)) {
+                ZPP_CHECK(child->contains(pointer));
+                child->deallocate(pointer, 1);
+            }
+            ZPP_CHECK(!child->allocated());
+        }
+        ZPP_CHECK(parent.allocated() == before);
+    }
+}
+} // namespace
+
+int main()
+{
+    test<zpp::allocator<std::byte>>();
+    test<zpp::basic_heap<zpp::best_fit, zpp::offset_links>>();
+    test<zpp::basic_heap<zpp::fast_bins<zpp::first_fit>,
+                         zpp::pointer_links,
+                         zpp::spin_lock>>();
+    test<zpp::basic_heap<zpp::deferred_coalescing<zpp::next_fit>>>();
+    std::printf("subheap ok\n");
+    return 0;
+}
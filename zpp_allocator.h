@@ -1,444 +1,2821 @@
 #ifndef ZPP_ALLOCATOR_H
 #define ZPP_ALLOCATOR_H
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <new>
 #include <type_traits>
+#include <utility>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace zpp
 {
-template <typename Type>
+template <typename Type, std::size_t Alignment = alignof(std::max_align_t)>
 class allocator;
 
-template <>
-class allocator<std::byte>
+// Block links that store full pointers to the neighbouring blocks,
+// every block carries a header of two pointers and a size.
+struct pointer_links
 {
-public:
-    template <typename Type>
-    struct span
+    template <std::size_t Alignment>
+    struct header
     {
-        auto data() const noexcept
+        struct launder{};
+
+        header() = default;
+        explicit header(std::size_t size) noexcept : m_size(size)
         {
-            return m_data;
         }
 
-        auto size() const noexcept
+        header(const header & other, launder) :
+            header(other)
         {
-            return m_size;
+            if (m_next) {
+                m_next->m_prev = std::launder(m_next->m_prev);
+            }
+
+            if (m_prev) {
+                m_prev->m_next = std::launder(m_prev->m_next);
+            }
         }
 
-        auto & front() const noexcept
+        header * next() const noexcept
         {
-            return *m_data;
+            return m_next;
         }
 
-        auto & back() const noexcept
+        header * prev() const noexcept
         {
-            return *(m_data + m_size);
+            return m_prev;
         }
 
-        auto begin() const noexcept
+        void set_next(header * next) noexcept
         {
-            return m_data;
+            m_next = next;
         }
 
-        auto end() const noexcept
+        void set_prev(header * prev) noexcept
         {
-            return m_data + m_size;
+            m_prev = prev;
         }
 
-        Type * m_data{};
+        bool is_free() const noexcept
+        {
+            return !(m_size & 0x1);
+        }
+
+        void set_free() noexcept
+        {
+            m_size &= ~std::size_t(0x1);
+        }
+
+        void set_allocated() noexcept
+        {
+            m_size |= 0x1;
+        }
+
+        std::size_t size() const noexcept
+        {
+            return m_size & ~std::size_t(0x1);
+        }
+
+        void resize(std::size_t size) noexcept
+        {
+            m_size = size | (m_size & 0x1);
+        }
+
+        constexpr static std::size_t max_size = ~std::size_t{} - 0x1;
+
+        header * m_next{};
+        header * m_prev{};
         std::size_t m_size{};
     };
 
-    struct list
+    template <typename Type, std::size_t Alignment>
+    struct link
     {
-        struct node
+        Type * get(const void *) const noexcept
         {
-            struct header;
-            struct launder{};
+            return m_pointer;
+        }
 
-            constexpr node() = default;
-            constexpr explicit node(std::size_t size)
-            {
-                m_header.m_size = size;
-            }
+        void set(const void *, Type * pointer) noexcept
+        {
+            m_pointer = pointer;
+        }
 
-            explicit node(const header & header, launder) :
-                m_header(header, launder{})
-            {
-            }
+        Type * m_pointer{};
+    };
+};
 
-            node(node &&) = delete;
-            node(const node &) = delete;
-            node & operator=(node &&) = delete;
-            node & operator=(const node &) = delete;
-            ~node() = default;
+// Block links that store 32 bit offsets in alignment units, the next
+// block is found through the size of the current block. Every block
+// carries an 8 byte header, and the heap size is limited to 4GiB.
+struct offset_links
+{
+    template <std::size_t Alignment>
+    struct header
+    {
+        struct launder{};
 
-            static node * assume_free(header * p)
-            {
-                return reinterpret_cast<node *>(p);
-            }
+        header() = default;
+        explicit header(std::size_t size) noexcept :
+            m_size(static_cast<std::uint32_t>(size) | last)
+        {
+        }
 
-            std::byte * address() noexcept
-            {
-                return reinterpret_cast<std::byte *>(this);
-            }
+        header(const header & other, launder) :
+            header(other)
+        {
+        }
 
-            const std::byte * address() const noexcept
-            {
-                return reinterpret_cast<const std::byte *>(this);
+        header * next() const noexcept
+        {
+            if (m_size & last) {
+                return nullptr;
             }
+            return std::launder(reinterpret_cast<header *>(
+                reinterpret_cast<std::uintptr_t>(this) + size()));
+        }
 
-            std::size_t size() const noexcept
-            {
-                return m_header.size();
+        header * prev() const noexcept
+        {
+            if (!m_prev) {
+                return nullptr;
             }
+            return std::launder(reinterpret_cast<header *>(
+                reinterpret_cast<std::uintptr_t>(this) -
+                std::uintptr_t(m_prev) * Alignment));
+        }
 
-            header * next() const noexcept
-            {
-                return m_header.m_next;
+        void set_next(header * next) noexcept
+        {
+            if (next) {
+                m_size &= ~last;
+            } else {
+                m_size |= last;
             }
+        }
 
-            node * next_free() const noexcept
-            {
-                return m_next_free;
-            }
+        void set_prev(header * prev) noexcept
+        {
+            m_prev = prev ? static_cast<std::uint32_t>(
+                                (reinterpret_cast<std::uintptr_t>(this) -
+                                 reinterpret_cast<std::uintptr_t>(prev)) /
+                                Alignment)
+                          : 0;
+        }
 
-            header * prev() const noexcept
-            {
-                return m_header.m_prev;
-            }
+        bool is_free() const noexcept
+        {
+            return !(m_size & allocated);
+        }
 
-            node * prev_free() const noexcept
-            {
-                return m_prev_free;
-            }
+        void set_free() noexcept
+        {
+            m_size &= ~allocated;
+        }
 
-            void append_to_list(node * p) noexcept
-            {
-                append_to_list(&p->m_header);
-            }
+        void set_allocated() noexcept
+        {
+            m_size |= allocated;
+        }
 
-            void append_to_list(header * p) noexcept
-            {
-                // Insert the node.
-                if (m_header.m_next) {
-                    m_header.m_next->m_prev = p;
-                }
-                p->m_next = m_header.m_next;
-                p->m_prev = &m_header;
-                m_header.m_next = p;
-            }
+        std::size_t size() const noexcept
+        {
+            return m_size & ~flags;
+        }
 
-            void prepend_to_list(node * p) noexcept
-            {
-                prepend_to_list(&p->m_header);
-            }
+        void resize(std::size_t size) noexcept
+        {
+            m_size = static_cast<std::uint32_t>(size) | (m_size & flags);
+        }
 
-            void prepend_to_list(header * p) noexcept
-            {
-                if (m_header.m_prev) {
-                    m_header.m_prev->m_next = p;
-                }
-                p->m_prev = m_header.m_prev;
-                p->m_next = &m_header;
-                m_header.m_prev = p;
+        constexpr static std::uint32_t allocated = 0x1;
+        constexpr static std::uint32_t last = 0x2;
+        constexpr static std::uint32_t flags = allocated | last;
+        constexpr static std::size_t max_size =
+            std::uint32_t(~flags) / Alignment * Alignment;
+
+        std::uint32_t m_prev{};
+        std::uint32_t m_size{};
+    };
+
+    template <typename Type, std::size_t Alignment>
+    struct link
+    {
+        Type * get(const void * owner) const noexcept
+        {
+            if (!m_offset) {
+                return nullptr;
             }
+            return std::launder(reinterpret_cast<Type *>(
+                reinterpret_cast<std::uintptr_t>(owner) +
+                std::intptr_t(m_offset) * std::intptr_t(Alignment)));
+        }
 
-            void append_to_freelist(node * p) noexcept
-            {
-                if (m_next_free) {
-                    m_next_free->m_prev_free = p;
+        void set(const void * owner, Type * pointer) noexcept
+        {
+            m_offset = pointer
+                           ? static_cast<std::int32_t>(
+                                 (reinterpret_cast<std::intptr_t>(pointer) -
+                                  reinterpret_cast<std::intptr_t>(owner)) /
+                                 std::intptr_t(Alignment))
+                           : 0;
+        }
+
+        std::int32_t m_offset{};
+    };
+};
+
+// Fit policies decide how free nodes are indexed and which free
+// node serves an allocation. An index keeps free nodes through their
+// free list links, and is notified whenever a free node is added,
+// removed, replaced by an adjacent node, or resized in place. Replace
+// and resize receive the size the node had when it was indexed.
+
+// Takes the first free node that fits, in address order. With Prefetch,
+// the list walks prefetch the node after the next one while examining
+// the current one, so that the misses of a long walk overlap.
+template <bool Prefetch = false>
+struct basic_first_fit
+{
+    template <typename Node>
+    class index
+    {
+    public:
+        Node * find(std::size_t size) const noexcept
+        {
+            for (auto p = m_first; p; p = p->next_free()) {
+                prefetch_next_free(p);
+                if (p->size() >= size) {
+                    return p;
                 }
-                p->m_next_free = m_next_free;
-                p->m_prev_free = this;
-                m_next_free = p;
-                p->set_free();
-                p->merge();
             }
+            return nullptr;
+        }
 
-            void prepend_to_freelist(node * p) noexcept
-            {
-                if (m_prev_free) {
-                    m_prev_free->m_next_free = p;
+        void insert(Node * node) noexcept
+        {
+            // Find the previous free node to keep the address order,
+            // there is none before the first free node.
+            for (auto p = node->prev();
+                 p && m_first && !std::less<const void *>{}(p, m_first);
+                 p = p->prev()) {
+                prefetch_prev(p);
+                if (!p->is_free()) {
+                    continue;
                 }
-                p->m_prev_free = m_prev_free;
-                p->m_next_free = this;
-                m_prev_free = p;
-                p->set_free();
-                p->merge();
+                link_after(Node::assume_free(p), node);
+                return;
             }
 
-            node * unlink_from_list() noexcept
-            {
-                if (m_header.m_prev) {
-                    m_header.m_prev->m_next = m_header.m_next;
-                }
+            // There is no free node before, prepend to the first.
+            link_first(node);
+        }
 
-                if (m_header.m_next) {
-                    m_header.m_next->m_prev = m_header.m_prev;
-                }
+        void remove(Node * node) noexcept
+        {
+            auto prev_free = node->prev_free();
+            auto next_free = node->next_free();
 
-                return this;
+            if (prev_free) {
+                prev_free->set_next_free(next_free);
             }
 
-            node * unlink_from_freelist() noexcept
-            {
-                if (m_prev_free) {
-                    m_prev_free->m_next_free = m_next_free;
-                }
-
-                if (m_next_free) {
-                    m_next_free->m_prev_free = m_prev_free;
-                }
+            if (next_free) {
+                next_free->set_prev_free(prev_free);
+            }
 
-                set_allocated();
-                return this;
+            if (node == m_first) {
+                m_first = next_free;
             }
+        }
 
-            node * split(std::size_t size) noexcept
-            {
-                // Create new node.
-                node * tail = ::new (address() + size) node(m_header.m_size - size);
-                append_to_list(tail);
-                append_to_freelist(tail);
+        void replace(Node * old, Node * node, std::size_t) noexcept
+        {
+            auto prev_free = old->prev_free();
+            auto next_free = old->next_free();
 
-                // Shrink current node.
-                m_header.m_size = size;
+            node->set_prev_free(prev_free);
+            node->set_next_free(next_free);
 
-                return tail;
+            if (prev_free) {
+                prev_free->set_next_free(node);
             }
 
-            void merge_next() noexcept
-            {
-                // Increase current size.
-                m_header.m_size += m_next_free->m_header.m_size;
-
-                // Remove next from free list.
-                m_next_free->unlink_from_freelist();
+            if (next_free) {
+                next_free->set_prev_free(node);
+            }
 
-                // Remove node from complete list.
-                assume_free(m_header.m_next)->unlink_from_list();
+            if (old == m_first) {
+                m_first = node;
             }
+        }
 
-            void merge() noexcept
-            {
-                if (m_next_free && address() + m_header.m_size ==
-                                       m_next_free->address()) {
-                    merge_next();
-                }
+        void resize(Node *, std::size_t) noexcept
+        {
+        }
 
-                if (m_prev_free && m_prev_free->address() +
-                                           m_prev_free->m_header.m_size ==
-                                       address()) {
-                    m_prev_free->merge_next();
+    protected:
+        static void prefetch_next_free(const Node * node) noexcept
+        {
+            if constexpr (Prefetch) {
+                if (auto next_free = node->next_free()) {
+                    prefetch(next_free->next_free());
                 }
             }
+        }
 
-            bool is_free() const noexcept
-            {
-                return m_header.is_free();
+        template <typename Header>
+        static void prefetch_prev(const Header * header) noexcept
+        {
+            if constexpr (Prefetch) {
+                if (auto prev = header->prev()) {
+                    prefetch(prev->prev());
+                }
             }
+        }
 
-            void set_free() noexcept
-            {
-                m_header.m_size &= ~std::size_t(0x1);
-            }
+        static void prefetch(const void * address) noexcept
+        {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_prefetch(address);
+#else
+            static_cast<void>(address);
+#endif
+        }
 
-            void set_allocated() noexcept
-            {
-                m_header.m_size |= 0x1;
+        void link_first(Node * node) noexcept
+        {
+            node->set_prev_free(nullptr);
+            node->set_next_free(m_first);
+            if (m_first) {
+                m_first->set_prev_free(node);
             }
+            m_first = node;
+        }
 
-            constexpr static std::size_t
-            alignment(std::size_t size) noexcept
-            {
-                return ((size + alignof(node) - 1) / alignof(node) *
-                        alignof(node)) -
-                       size;
+        void link_after(Node * prev, Node * node) noexcept
+        {
+            auto next_free = prev->next_free();
+            if (next_free) {
+                next_free->set_prev_free(node);
             }
+            node->set_next_free(next_free);
+            node->set_prev_free(prev);
+            prev->set_next_free(node);
+        }
 
-            struct header
-            {
-                header() = default;
-                header(const header & other, launder) :
-                    header(other)
-                {
-                    if (m_next) {
-                        m_next->m_prev = std::launder(m_next->m_prev);
-                    }
-
-                    if (m_prev) {
-                        m_prev->m_next = std::launder(m_prev->m_next);
-                    }
-                }
+        Node * m_first{};
+    };
+};
 
-                bool is_free() const noexcept
-                {
-                    return !(m_size & 0x1);
-                }
+using first_fit = basic_first_fit<>;
 
-                std::byte * data() noexcept
-                {
-                    return std::launder(
-                        reinterpret_cast<std::byte *>(this + 1));
+// Takes the smallest free node that fits, in address order among equals.
+template <bool Prefetch = false>
+struct basic_best_fit
+{
+    template <typename Node>
+    class index : public basic_first_fit<Prefetch>::template index<Node>
+    {
+    public:
+        Node * find(std::size_t size) const noexcept
+        {
+            Node * best{};
+            for (auto p = this->m_first; p; p = p->next_free()) {
+                this->prefetch_next_free(p);
+                if (p->size() < size ||
+                    (best && best->size() <= p->size())) {
+                    continue;
                 }
 
-                std::size_t size() const noexcept
-                {
-                    return m_size & ~std::size_t(0x1);
+                // An exact fit cannot be improved.
+                best = p;
+                if (p->size() == size) {
+                    break;
                 }
+            }
+            return best;
+        }
+    };
+};
 
-                std::size_t data_size() const noexcept
-                {
-                    return size() - sizeof(*this);
-                }
+using best_fit = basic_best_fit<>;
 
-                static auto from_data(std::byte * data) noexcept
-                {
-                    return std::launder(
-                        reinterpret_cast<header *>(data - sizeof(header)));
+// Takes the first free node that fits in address order, starting from
+// where the last search succeeded and wrapping around, so that the small
+// nodes at the start of the heap are not rescanned by every search.
+struct next_fit
+{
+    template <typename Node>
+    class index : public first_fit::index<Node>
+    {
+    public:
+        Node * find(std::size_t size) const noexcept
+        {
+            auto rover = m_rover ? m_rover : this->m_first;
+            for (auto p = rover; p; p = p->next_free()) {
+                if (p->size() >= size) {
+                    return m_rover = p;
                 }
+            }
 
-                static auto from_data(const std::byte * data) noexcept
-                {
-                    return std::launder(reinterpret_cast<const header *>(
-                        data - sizeof(header)));
+            for (auto p = this->m_first; p != rover; p = p->next_free()) {
+                if (p->size() >= size) {
+                    return m_rover = p;
                 }
-
-                alignas(std::max_align_t) header * m_next{};
-                header * m_prev{};
-                std::size_t m_size{};
-            } m_header;
-            node * m_next_free{};
-            node * m_prev_free{};
-        };
-
-        explicit list(const span<std::byte> & memory) noexcept :
-            m_first_free(::new (memory.data()) node(memory.size())),
-            m_first(m_first_free)
-        {
+            }
+            return nullptr;
         }
 
-        list(list && other) noexcept :
-            m_first_free(other.m_first_free),
-            m_allocated(other.m_allocated)
+        void remove(Node * node) noexcept
         {
-            other.m_first_free = nullptr;
-            other.m_allocated = {};
+            // Move on to the next free node in address order.
+            if (node == m_rover) {
+                m_rover = node->next_free();
+            }
+            first_fit::index<Node>::remove(node);
         }
 
-        list & operator=(list && other) noexcept
+        void replace(Node * old, Node * node, std::size_t size) noexcept
         {
-            m_first_free = other.m_first_free;
-            m_allocated = other.m_allocated;
-            other.m_first_free = nullptr;
-            other.m_allocated = {};
-            return *this;
+            if (old == m_rover) {
+                m_rover = node;
+            }
+            first_fit::index<Node>::replace(old, node, size);
         }
 
-        list(const list &) = delete;
-        list & operator=(const list &) = delete;
+    protected:
+        mutable Node * m_rover{};
+    };
+};
 
-        node::header * allocate(std::size_t size) const noexcept
+// Keeps free nodes in bins of power of two size classes, and takes the
+// first fitting node of the smallest bin that has one.
+template <std::size_t Bins = 48>
+struct segregated_fit
+{
+    template <typename Node>
+    class index
+    {
+    public:
+        Node * find(std::size_t size) const noexcept
         {
-            // Block sizes include the header.
-            size += sizeof(node::header);
+            auto bin = bin_of(size);
 
-            // Make sure we only allocate properly aligned data.
-            size += node::alignment(size);
-
-            for (auto p = m_first_free; p; p = p->next_free()) {
-                // If not enough size, continue.
-                if (p->size() < size) {
-                    continue;
+            // Nodes of the same class may still be too small.
+            for (auto p = m_bins[bin]; p; p = p->next_free()) {
+                if (p->size() >= size) {
+                    return p;
                 }
+            }
 
-                // If there is leftover space for a node,
-                // split the current node.
-                if (p->size() - size >= sizeof(node)) {
-                    p->split(size);
+            // Any node of a larger class fits.
+            for (++bin; bin < Bins; ++bin) {
+                if (m_bins[bin]) {
+                    return m_bins[bin];
                 }
+            }
+            return nullptr;
+        }
 
-                // Unlink the node from the freelist.
-                p->unlink_from_freelist();
+        void insert(Node * node) noexcept
+        {
+            auto & first = m_bins[bin_of(node->size())];
+            node->set_prev_free(nullptr);
+            node->set_next_free(first);
+            if (first) {
+                first->set_prev_free(node);
+            }
+            first = node;
+        }
 
-                // If we just allocated the first node,
-                // update the first free node.
-                if (p == m_first_free) {
-                    m_first_free = p->next_free();
-                }
+        void remove(Node * node) noexcept
+        {
+            remove(node, node->size());
+        }
 
-                // Count allocation.
-                m_allocated += p->size();
+        void replace(Node * old, Node * node, std::size_t old_size) noexcept
+        {
+            remove(old, old_size);
+            insert(node);
+        }
 
-                // Replace the full node with a header.
-                auto header = p->m_header;
-                return ::new (static_cast<void *>(p))
-                    node::header(header, node::launder{});
+        void resize(Node * node, std::size_t old_size) noexcept
+        {
+            if (bin_of(node->size()) == bin_of(old_size)) {
+                return;
             }
-
-            return nullptr;
+            remove(node, old_size);
+            insert(node);
         }
 
-        void deallocate(node::header * h, std::size_t) const noexcept
+    private:
+        void remove(Node * node, std::size_t size) noexcept
+        {
+            auto prev_free = node->prev_free();
+            auto next_free = node->next_free();
+
+            if (prev_free) {
+                prev_free->set_next_free(next_free);
+            } else {
+                m_bins[bin_of(size)] = next_free;
+            }
+
+            if (next_free) {
+                next_free->set_prev_free(prev_free);
+            }
+        }
+
+        static std::size_t bin_of(std::size_t size) noexcept
+        {
+            size /= Node::min_size();
+            if (!size) {
+                return 0;
+            }
+
+            // The bin is the index of the highest set bit.
+            std::size_t bin{};
+#if defined(__GNUC__) || defined(__clang__)
+            bin = sizeof(unsigned long long) * 8 - 1 -
+                  __builtin_clzll(static_cast<unsigned long long>(size));
+#else
+            while (size >>= 1) {
+                ++bin;
+            }
+#endif
+            return bin < Bins ? bin : Bins - 1;
+        }
+
+        Node * m_bins[Bins]{};
+    };
+};
+
+// First fit that mirrors the address ordered free list in a sorted
+// structure of arrays of node sizes and nodes, which is scanned with
+// vector compares where available. While there are more free nodes than
+// the capacity, the index falls back to the free list walk of first_fit.
+template <std::size_t Capacity = 256>
+struct indexed_fit
+{
+    template <typename Node>
+    class index : public first_fit::index<Node>
+    {
+    public:
+        Node * find(std::size_t size) const noexcept
+        {
+            if (m_overflow || size > max_size) {
+                return first_fit::index<Node>::find(size);
+            }
+
+            auto position = search(static_cast<std::uint32_t>(size));
+            if (position == m_size) {
+                return nullptr;
+            }
+            return m_nodes[position];
+        }
+
+        void insert(Node * node) noexcept
+        {
+            ++m_count;
+            if (m_overflow || m_size == capacity) {
+                m_overflow = true;
+                first_fit::index<Node>::insert(node);
+                return;
+            }
+
+            // The previous node in the array is the previous free node.
+            auto position = lower_bound(node);
+            if (position) {
+                this->link_after(m_nodes[position - 1], node);
+            } else {
+                this->link_first(node);
+            }
+
+            for (auto i = m_size; i > position; --i) {
+                m_nodes[i] = m_nodes[i - 1];
+                m_sizes[i] = m_sizes[i - 1];
+            }
+            m_nodes[position] = node;
+            m_sizes[position] = clamp(node->size());
+            ++m_size;
+        }
+
+        void remove(Node * node) noexcept
+        {
+            --m_count;
+            first_fit::index<Node>::remove(node);
+
+            if (m_overflow) {
+                // Rebuild once the free nodes fit comfortably.
+                if (m_count <= capacity / 2) {
+                    rebuild();
+                }
+                return;
+            }
+
+            auto position = lower_bound(node);
+            --m_size;
+            for (auto i = position; i < m_size; ++i) {
+                m_nodes[i] = m_nodes[i + 1];
+                m_sizes[i] = m_sizes[i + 1];
+            }
+
+            // Unused sizes stay zero so that they never fit.
+            m_sizes[m_size] = 0;
+        }
+
+        void replace(Node * old, Node * node, std::size_t size) noexcept
+        {
+            first_fit::index<Node>::replace(old, node, size);
+            if (m_overflow) {
+                return;
+            }
+
+            auto position = lower_bound(old);
+            m_nodes[position] = node;
+            m_sizes[position] = clamp(node->size());
+        }
+
+        void resize(Node * node, std::size_t) noexcept
+        {
+            if (m_overflow) {
+                return;
+            }
+            m_sizes[lower_bound(node)] = clamp(node->size());
+        }
+
+    private:
+        // Sizes are compared in 32 bits, larger sizes saturate.
+        constexpr static std::size_t max_size = ~std::uint32_t{};
+
+        // Vectors read whole groups of eight sizes.
+        constexpr static std::size_t capacity = (Capacity + 7) / 8 * 8;
+
+        static std::uint32_t clamp(std::size_t size) noexcept
+        {
+            return size > max_size ? std::uint32_t(max_size)
+                                   : static_cast<std::uint32_t>(size);
+        }
+
+        std::size_t lower_bound(const Node * node) const noexcept
+        {
+            std::size_t begin{};
+            std::size_t end = m_size;
+            while (begin < end) {
+                auto middle = begin + (end - begin) / 2;
+                if (std::less<const Node *>{}(m_nodes[middle], node)) {
+                    begin = middle + 1;
+                } else {
+                    end = middle;
+                }
+            }
+            return begin;
+        }
+
+        // Returns the position of the first size that fits, or the
+        // array size if there is none.
+        std::size_t search(std::uint32_t size) const noexcept
+        {
+            std::size_t i{};
+#if defined(__AVX2__)
+            // Unsigned compare through the signed compare of biased values.
+            auto bias = _mm256_set1_epi32(std::int32_t(0x80000000));
+            auto needle =
+                _mm256_xor_si256(_mm256_set1_epi32(std::int32_t(size)), bias);
+            for (; i < m_size; i += 8) {
+                auto sizes = _mm256_xor_si256(
+                    _mm256_load_si256(
+                        reinterpret_cast<const __m256i *>(m_sizes + i)),
+                    bias);
+                auto smaller = _mm256_movemask_ps(
+                    _mm256_castsi256_ps(_mm256_cmpgt_epi32(needle, sizes)));
+                if (auto fits = ~smaller & 0xff) {
+                    i += __builtin_ctz(fits);
+                    return i < m_size ? i : m_size;
+                }
+            }
+            return m_size;
+#elif defined(__SSE2__)
+            auto bias = _mm_set1_epi32(std::int32_t(0x80000000));
+            auto needle =
+                _mm_xor_si128(_mm_set1_epi32(std::int32_t(size)), bias);
+            for (; i < m_size; i += 4) {
+                auto sizes = _mm_xor_si128(
+                    _mm_load_si128(
+                        reinterpret_cast<const __m128i *>(m_sizes + i)),
+                    bias);
+                auto smaller = _mm_movemask_ps(
+                    _mm_castsi128_ps(_mm_cmpgt_epi32(needle, sizes)));
+                if (auto fits = ~smaller & 0xf) {
+                    i += __builtin_ctz(fits);
+                    return i < m_size ? i : m_size;
+                }
+            }
+            return m_size;
+#elif defined(__ARM_NEON)
+            auto needle = vdupq_n_u32(size);
+            for (; i < m_size; i += 4) {
+                auto fits = vmovn_u32(vcgeq_u32(vld1q_u32(m_sizes + i), needle));
+                if (auto bits = vget_lane_u64(vreinterpret_u64_u16(fits), 0)) {
+                    i += __builtin_ctzll(bits) / 16;
+                    return i < m_size ? i : m_size;
+                }
+            }
+            return m_size;
+#else
+            for (; i < m_size; ++i) {
+                if (m_sizes[i] >= size) {
+                    break;
+                }
+            }
+            return i;
+#endif
+        }
+
+        void rebuild() noexcept
+        {
+            m_size = 0;
+            for (auto p = this->m_first; p; p = p->next_free()) {
+                m_nodes[m_size] = p;
+                m_sizes[m_size] = clamp(p->size());
+                ++m_size;
+            }
+            for (auto i = m_size; i < capacity; ++i) {
+                m_sizes[i] = 0;
+            }
+            m_overflow = false;
+        }
+
+        alignas(32) std::uint32_t m_sizes[capacity]{};
+        Node * m_nodes[capacity]{};
+        std::size_t m_size{};
+        std::size_t m_count{};
+        bool m_overflow{};
+    };
+};
+
+// Carves allocations off the end of the chosen free node, so that the
+// free node shrinks in place instead of being replaced by the leftover.
+template <typename FitPolicy>
+struct tail_split : FitPolicy
+{
+    constexpr static bool split_tail = true;
+};
+
+template <typename FitPolicy, typename = void>
+struct splits_tail : std::false_type
+{
+};
+
+template <typename FitPolicy>
+struct splits_tail<FitPolicy, std::void_t<decltype(FitPolicy::split_tail)>>
+    : std::bool_constant<FitPolicy::split_tail>
+{
+};
+
+// Keeps freed blocks of up to MaxSize bytes, headers included, in per
+// size LIFO bins without coalescing them, so that a free followed by an
+// allocation of the same size is a push and a pop. The bins are merged
+// back into the free nodes when an allocation fails, or by consolidate().
+template <typename FitPolicy, std::size_t MaxSize = 128>
+struct fast_bins : FitPolicy
+{
+    constexpr static std::size_t fast_bin_max = MaxSize;
+};
+
+template <typename FitPolicy, typename = void>
+struct fast_bin_limit : std::integral_constant<std::size_t, 0>
+{
+};
+
+template <typename FitPolicy>
+struct fast_bin_limit<FitPolicy,
+                      std::void_t<decltype(FitPolicy::fast_bin_max)>>
+    : std::integral_constant<std::size_t, FitPolicy::fast_bin_max>
+{
+};
+
+// Defers coalescing of freed blocks, which wait allocated in a pending
+// list instead. Every allocation consolidates up to Budget pending blocks,
+// taking one that fits exactly without splitting it. The pending list is
+// consolidated completely when an allocation fails, or by consolidate().
+template <typename FitPolicy, std::size_t Budget = 4>
+struct deferred_coalescing : FitPolicy
+{
+    constexpr static std::size_t coalesce_budget = Budget;
+};
+
+template <typename FitPolicy, typename = void>
+struct coalescing_budget : std::integral_constant<std::size_t, 0>
+{
+};
+
+template <typename FitPolicy>
+struct coalescing_budget<FitPolicy,
+                         std::void_t<decltype(FitPolicy::coalesce_budget)>>
+    : std::integral_constant<std::size_t, FitPolicy::coalesce_budget>
+{
+};
+
+// Lock policies guard every heap operation.
+struct no_lock
+{
+    void lock() noexcept
+    {
+    }
+
+    void unlock() noexcept
+    {
+    }
+};
+
+class spin_lock
+{
+public:
+    void lock() noexcept
+    {
+        while (m_flag.test_and_set(std::memory_order_acquire)) {
+        }
+    }
+
+    void unlock() noexcept
+    {
+        m_flag.clear(std::memory_order_release);
+    }
+
+private:
+    std::atomic_flag m_flag = ATOMIC_FLAG_INIT;
+};
+
+template <typename LockPolicy>
+class guard
+{
+public:
+    explicit guard(LockPolicy & lock) noexcept : m_lock(lock)
+    {
+        m_lock.lock();
+    }
+
+    guard(const guard &) = delete;
+    guard & operator=(const guard &) = delete;
+
+    ~guard()
+    {
+        m_lock.unlock();
+    }
+
+private:
+    LockPolicy & m_lock;
+};
+
+// Stats policies are told about every allocated and freed block.
+struct no_stats
+{
+    void on_allocate(std::size_t) noexcept
+    {
+    }
+
+    void on_deallocate(std::size_t) noexcept
+    {
+    }
+};
+
+struct basic_stats
+{
+    void on_allocate(std::size_t size) noexcept
+    {
+        m_allocated += size;
+    }
+
+    void on_deallocate(std::size_t size) noexcept
+    {
+        m_allocated -= size;
+    }
+
+    std::size_t allocated() const noexcept
+    {
+        return m_allocated;
+    }
+
+    std::size_t m_allocated{};
+};
+
+template <typename Heap>
+class subheap;
+
+// Expected lifetime of an allocation, short lived blocks are placed
+// apart from the others so that they do not pin fragments between them.
+enum class lifetime
+{
+    long_lived,
+    short_lived,
+};
+
+// Tells a heap that its memory is zero filled, such as fresh pages,
+// so that zeroed allocations skip clearing the space never handed out.
+struct zero_filled
+{
+};
+
+template <typename FitPolicy = first_fit,
+          typename LinkPolicy = pointer_links,
+          typename LockPolicy = no_lock,
+          typename StatsPolicy = basic_stats,
+          std::size_t Alignment = alignof(std::max_align_t)>
+class basic_heap
+{
+public:
+    constexpr static std::size_t min_align = Alignment;
+
+    static_assert(Alignment && !(Alignment & (Alignment - 1)),
+                  "Alignment must be a power of two.");
+
+    template <typename Type>
+    struct span
+    {
+        auto data() const noexcept
+        {
+            return m_data;
+        }
+
+        auto size() const noexcept
+        {
+            return m_size;
+        }
+
+        auto & front() const noexcept
+        {
+            return *m_data;
+        }
+
+        auto & back() const noexcept
+        {
+            return *(m_data + m_size);
+        }
+
+        auto begin() const noexcept
+        {
+            return m_data;
+        }
+
+        auto end() const noexcept
+        {
+            return m_data + m_size;
+        }
+
+        Type * m_data{};
+        std::size_t m_size{};
+    };
+
+    struct list
+    {
+        struct node
+        {
+            using header = typename LinkPolicy::template header<min_align>;
+            using launder = typename header::launder;
+            using link = typename LinkPolicy::template link<node, min_align>;
+
+            constexpr node() = default;
+            constexpr explicit node(std::size_t size) : m_header(size)
+            {
+            }
+
+            explicit node(const header & header, launder) :
+                m_header(header, launder{})
+            {
+            }
+
+            node(node &&) = delete;
+            node(const node &) = delete;
+            node & operator=(node &&) = delete;
+            node & operator=(const node &) = delete;
+            ~node() = default;
+
+            static node * assume_free(header * p)
+            {
+                return reinterpret_cast<node *>(p);
+            }
+
+            std::byte * address() noexcept
+            {
+                return reinterpret_cast<std::byte *>(this);
+            }
+
+            const std::byte * address() const noexcept
+            {
+                return reinterpret_cast<const std::byte *>(this);
+            }
+
+            std::size_t size() const noexcept
+            {
+                return m_header.size();
+            }
+
+            header * next() const noexcept
+            {
+                return m_header.next();
+            }
+
+            node * next_free() const noexcept
+            {
+                return m_next_free.get(this);
+            }
+
+            header * prev() const noexcept
+            {
+                return m_header.prev();
+            }
+
+            node * prev_free() const noexcept
+            {
+                return m_prev_free.get(this);
+            }
+
+            void set_next_free(node * p) noexcept
+            {
+                m_next_free.set(this, p);
+            }
+
+            void set_prev_free(node * p) noexcept
+            {
+                m_prev_free.set(this, p);
+            }
+
+            void append_to_list(node * p) noexcept
+            {
+                append_to_list(&p->m_header);
+            }
+
+            void append_to_list(header * p) noexcept
+            {
+                // Insert the node, its size must already reach
+                // the next node.
+                auto next = m_header.next();
+                if (next) {
+                    next->set_prev(p);
+                }
+                p->set_next(next);
+                p->set_prev(&m_header);
+                m_header.set_next(p);
+            }
+
+            node * unlink_from_list() noexcept
+            {
+                auto prev = m_header.prev();
+                auto next = m_header.next();
+
+                if (prev) {
+                    prev->set_next(next);
+                }
+
+                if (next) {
+                    next->set_prev(prev);
+                }
+
+                return this;
+            }
+
+            node * split(std::size_t size) noexcept
+            {
+                // Create new node.
+                node * tail = ::new (address() + size) node(this->size() - size);
+                append_to_list(tail);
+
+                // Shrink current node.
+                m_header.resize(size);
+
+                return tail;
+            }
+
+            header * split_tail(std::size_t size) noexcept
+            {
+                // Create a header at the end.
+                auto tail = ::new (address() + this->size() - size)
+                    header(size);
+                append_to_list(tail);
+
+                // Shrink current node.
+                m_header.resize(this->size() - size);
+
+                return tail;
+            }
+
+            void merge_next() noexcept
+            {
+                auto next = assume_free(m_header.next());
+
+                // Increase current size.
+                m_header.resize(size() + next->size());
+
+                // Remove node from complete list.
+                next->unlink_from_list();
+            }
+
+            bool is_free() const noexcept
+            {
+                return m_header.is_free();
+            }
+
+            void set_free() noexcept
+            {
+                m_header.set_free();
+            }
+
+            void set_allocated() noexcept
+            {
+                m_header.set_allocated();
+            }
+
+            constexpr static std::size_t
+            alignment(std::size_t size) noexcept
+            {
+                return ((size + min_align - 1) / min_align * min_align) -
+                       size;
+            }
+
+            // The smallest block that can hold a free node.
+            constexpr static std::size_t min_size() noexcept
+            {
+                return sizeof(node) + alignment(sizeof(node));
+            }
+
+            header m_header;
+            link m_next_free{};
+            link m_prev_free{};
+        };
+
+        using header = typename node::header;
+        using index = typename FitPolicy::template index<node>;
+
+        constexpr static std::size_t fast_bin_max =
+            fast_bin_limit<FitPolicy>::value;
+        constexpr static std::size_t fast_bin_count =
+            fast_bin_max ? fast_bin_max / min_align + 1 : 1;
+        constexpr static std::size_t coalesce_budget =
+            coalescing_budget<FitPolicy>::value;
+
+        // Blocks examined on each side by allocate_near().
+        constexpr static std::size_t near_reach = 8;
+
+        static_assert(min_align >= 4 && min_align >= alignof(header),
+                      "Alignment too small for the block header.");
+
+        // The whole region starts as the top node, which is carved
+        // by allocations that no indexed free node can serve. It is
+        // marked allocated so that fit policies never take it. The
+        // bytes in [zero_begin, zero_end) are known to be zero.
+        explicit list(const span<std::byte> & memory,
+                      std::byte * zero_begin = nullptr,
+                      std::byte * zero_end = nullptr) noexcept :
+            m_first(::new (memory.data()) node(memory.size())),
+            m_top(m_first),
+            m_zero_begin(zero_begin),
+            m_zero_end(zero_end)
+        {
+            m_top->set_allocated();
+            if (auto end = m_top->address() + sizeof(node);
+                m_zero_begin && m_zero_begin < end) {
+                m_zero_begin = end;
+            }
+        }
+
+        list(list && other) noexcept :
+            m_index(other.m_index),
+            m_upper_index(other.m_upper_index),
+            m_first(other.m_first),
+            m_top(other.m_top),
+            m_pending(other.m_pending),
+            m_indexed(other.m_indexed),
+            m_boundary(other.m_boundary),
+            m_zero_begin(other.m_zero_begin),
+            m_zero_end(other.m_zero_end)
+        {
+            other.m_index = {};
+            other.m_upper_index = {};
+            other.m_first = nullptr;
+            other.m_top = nullptr;
+            other.m_pending = nullptr;
+            other.m_indexed = 0;
+            move_fast_bins(other);
+        }
+
+        list & operator=(list && other) noexcept
+        {
+            m_index = other.m_index;
+            m_upper_index = other.m_upper_index;
+            m_first = other.m_first;
+            m_top = other.m_top;
+            m_pending = other.m_pending;
+            m_indexed = other.m_indexed;
+            m_boundary = other.m_boundary;
+            m_zero_begin = other.m_zero_begin;
+            m_zero_end = other.m_zero_end;
+            other.m_index = {};
+            other.m_upper_index = {};
+            other.m_first = nullptr;
+            other.m_top = nullptr;
+            other.m_pending = nullptr;
+            other.m_indexed = 0;
+            move_fast_bins(other);
+            return *this;
+        }
+
+        list(const list &) = delete;
+        list & operator=(const list &) = delete;
+
+        static std::byte * data(header * h) noexcept
+        {
+            return std::launder(reinterpret_cast<std::byte *>(h + 1));
+        }
+
+        static std::size_t data_size(const header * h) noexcept
+        {
+            return h->size() - sizeof(header);
+        }
+
+        static header * from_data(std::byte * data) noexcept
+        {
+            return std::launder(
+                reinterpret_cast<header *>(data - sizeof(header)));
+        }
+
+        static const header * from_data(const std::byte * data) noexcept
+        {
+            return std::launder(
+                reinterpret_cast<const header *>(data - sizeof(header)));
+        }
+
+        // Returns the block size for a data size, or zero if it
+        // cannot be represented.
+        static std::size_t block_size(std::size_t size) noexcept
+        {
+            // Refuse sizes that cannot be represented.
+            if (size > header::max_size - node::min_size()) {
+                return 0;
+            }
+
+            // Block sizes include the header.
+            size += sizeof(header);
+
+            // Make sure we only allocate properly aligned data.
+            size += node::alignment(size);
+
+            // A block must be able to hold a free node once released.
+            if (size < node::min_size()) {
+                size = node::min_size();
+            }
+            return size;
+        }
+
+        header * allocate(std::size_t size, lifetime hint) noexcept
+        {
+            size = block_size(size);
+            if (!size) {
+                return nullptr;
+            }
+            return allocate_block(size, hint);
+        }
+
+        header * allocate_block(std::size_t size, lifetime hint) noexcept
+        {
+            // Reuse a block of the same size from its fast bin.
+            if constexpr (fast_bin_max != 0) {
+                if (size <= fast_bin_max) {
+                    if (auto & bin = m_fast_bins[size / min_align]) {
+                        auto p = bin;
+                        bin = p->next_free();
+                        return reuse(p);
+                    }
+                }
+            }
+
+            // Consolidate a few pending blocks, reusing one that
+            // would not be split anyway.
+            if constexpr (coalesce_budget != 0) {
+                for (std::size_t i = 0; i < coalesce_budget && m_pending;
+                     ++i) {
+                    auto p = m_pending;
+                    m_pending = p->next_free();
+                    if (p->size() >= size &&
+                        p->size() - size < node::min_size()) {
+                        return reuse(p);
+                    }
+                    release(p);
+                }
+            }
+
+            // Long lived blocks are taken from below the top node and
+            // bumped off its start, short lived blocks are taken from
+            // above it and carved off its end, and each falls back to
+            // the other side.
+            for (auto retry = false;; retry = true) {
+                auto & near = zone(hint == lifetime::short_lived);
+                auto & far = zone(hint != lifetime::short_lived);
+                if (auto block = allocate_from(near, size)) {
+                    return block;
+                }
+                if (auto block = allocate_top(size, hint)) {
+                    return block;
+                }
+                if (auto block = allocate_from(far, size)) {
+                    return block;
+                }
+                if (retry || !consolidate()) {
+                    return nullptr;
+                }
+            }
+        }
+
+        // Returns the header of the block whose data starts at the
+        // address, or null if the address is not aligned as block data
+        // or the header before it does not link with its neighbours.
+        const header * block_at(const std::byte * data,
+                                const span<std::byte> & memory) const noexcept
+        {
+            // Headers are placed every min_align bytes from the start.
+            auto begin = reinterpret_cast<std::uintptr_t>(memory.data());
+            auto end = begin + memory.size();
+            auto address = reinterpret_cast<std::uintptr_t>(data);
+            if (address < begin + sizeof(header) || address >= end ||
+                (address - sizeof(header) - begin) % min_align) {
+                return nullptr;
+            }
+            auto h = from_data(data);
+            if (!linked(h, begin, end)) {
+                return nullptr;
+            }
+            return h;
+        }
+
+        // Whether a header that may be garbage is a block of the list,
+        // reading only within the region.
+        static bool linked(const header * h,
+                           std::uintptr_t begin,
+                           std::uintptr_t end) noexcept
+        {
+            auto address = reinterpret_cast<std::uintptr_t>(h);
+            auto size = h->size();
+            if (size % min_align || size <= sizeof(header) ||
+                size > end - address) {
+                return false;
+            }
+
+            // Blocks tile the region, and their neighbours link back.
+            if (auto next = h->next()) {
+                if (reinterpret_cast<std::uintptr_t>(next) != address + size ||
+                    address + size + sizeof(header) > end ||
+                    next->prev() != h) {
+                    return false;
+                }
+            } else if (address + size != end) {
+                return false;
+            }
+
+            auto prev = h->prev();
+            if (!prev) {
+                return address == begin;
+            }
+            auto prev_address = reinterpret_cast<std::uintptr_t>(prev);
+            return begin <= prev_address && prev_address < address &&
+                   prev_address + prev->size() == address &&
+                   prev->next() == h;
+        }
+
+        // Looks for a free node among the blocks physically around the
+        // given allocated block, nearest first, before allocating
+        // from anywhere.
+        header * allocate_near(const header * near,
+                               std::size_t size) noexcept
+        {
+            size = block_size(size);
+            if (!size) {
+                return nullptr;
+            }
+
+            // The top node is carved on the side facing the block.
+            auto next = near->next();
+            auto prev = near->prev();
+            for (std::size_t i = 0; i < near_reach && (next || prev); ++i) {
+                if (auto block =
+                        allocate_at(next, size, lifetime::long_lived)) {
+                    return block;
+                }
+                if (auto block =
+                        allocate_at(prev, size, lifetime::short_lived)) {
+                    return block;
+                }
+                next = next ? next->next() : nullptr;
+                prev = prev ? prev->prev() : nullptr;
+            }
+            return allocate_block(size, lifetime::long_lived);
+        }
+
+        // Allocates from the given block if it is a free node that fits,
+        // or from the top node's start or end as the hint tells.
+        header *
+        allocate_at(header * h, std::size_t size, lifetime hint) noexcept
+        {
+            if (!h) {
+                return nullptr;
+            }
+            if (h == top_header()) {
+                return allocate_top(size, hint);
+            }
+            if (!h->is_free() || h->size() < size) {
+                return nullptr;
+            }
+            return take(zone_of(h), node::assume_free(h), size);
+        }
+
+        header * allocate_from(index & free, std::size_t size) noexcept
+        {
+            // Until blocks are released only the top node is free.
+            auto p = m_indexed ? free.find(size) : nullptr;
+            if (!p) {
+                return nullptr;
+            }
+            return take(free, p, size);
+        }
+
+        header * take(index & free, node * p, std::size_t size) noexcept
+        {
+            // If there is leftover space for a node, split the
+            // current node and let the leftover take its place,
+            // or carve the block off the end of the current node
+            // which then stays in place.
+            if (auto old_size = p->size();
+                old_size - size >= node::min_size()) {
+                if constexpr (splits_tail<FitPolicy>::value) {
+                    auto block = p->split_tail(size);
+                    free.resize(p, old_size);
+                    block->set_allocated();
+                    return block;
+                } else {
+                    auto tail = p->split(size);
+                    free.replace(p, tail, old_size);
+                }
+            } else {
+                free.remove(p);
+                --m_indexed;
+            }
+            p->set_allocated();
+
+            // Replace the full node with a header.
+            auto header = p->m_header;
+            return ::new (static_cast<void *>(p))
+                typename node::header(header, typename node::launder{});
+        }
+
+        void deallocate(header * h, std::size_t) noexcept
         {
             // Recreate the full node.
             auto header = *h;
-            auto node = ::new (static_cast<void *>(h)) struct node(
-                header, node::launder{});
+            auto node = ::new (static_cast<void *>(h))
+                typename list::node(header, typename node::launder{});
+
+            // Small blocks stay allocated in their fast bin.
+            if constexpr (fast_bin_max != 0) {
+                if (node->size() <= fast_bin_max) {
+                    auto & bin = m_fast_bins[node->size() / min_align];
+                    node->set_next_free(bin);
+                    bin = node;
+                    return;
+                }
+            }
+
+            // Other blocks wait allocated in the pending list.
+            if constexpr (coalesce_budget != 0) {
+                node->set_next_free(m_pending);
+                m_pending = node;
+                return;
+            }
+
+            release(node);
+        }
+
+        // Returns whether any block was held back from coalescing.
+        bool consolidate() noexcept
+        {
+            auto consolidated = false;
+            if constexpr (fast_bin_max != 0) {
+                for (auto & bin : m_fast_bins) {
+                    while (auto p = bin) {
+                        bin = p->next_free();
+                        release(p);
+                        consolidated = true;
+                    }
+                }
+            }
+            while (auto p = m_pending) {
+                m_pending = p->next_free();
+                release(p);
+                consolidated = true;
+            }
+            return consolidated;
+        }
+
+        // Bumps the block off the start of the top node, or off its
+        // end for short lived blocks.
+        header * allocate_top(std::size_t size, lifetime hint) noexcept
+        {
+            auto p = m_top;
+            if (!p || p->size() < size) {
+                return nullptr;
+            }
+
+            // Whatever is handed out leaves the known zero bytes.
+            auto old_size = p->size();
+            if (old_size - size < node::min_size()) {
+                m_top = nullptr;
+                m_boundary = p->address();
+                m_zero_begin = m_zero_end = nullptr;
+                return reuse(p);
+            }
+
+            if (hint == lifetime::short_lived) {
+                auto block = p->split_tail(size);
+                block->set_allocated();
+                auto begin = reinterpret_cast<std::byte *>(block);
+                if (m_zero_end && m_zero_end > begin) {
+                    m_zero_end = begin;
+                }
+                return block;
+            }
+
+            // The top node is never indexed, so it needs only a header.
+            auto top = ::new (p->address() + size) header(old_size - size);
+            auto end = reinterpret_cast<std::byte *>(top + 1);
+            if (m_zero_begin && m_zero_begin < end) {
+                m_zero_begin = end;
+            }
+            p->append_to_list(top);
+            p->m_header.resize(size);
+            top->set_allocated();
+            m_top = node::assume_free(top);
+            return reuse(p);
+        }
+
+        // Merges the node and its free neighbours into the top node.
+        void grow_top(node * node, header * prev, header * next) noexcept
+        {
+            auto top = top_header();
+            auto merge_next = next && (next == top || next->is_free());
+            auto merge_prev = prev && (prev == top || prev->is_free());
+
+            // Indexed neighbours leave the index before they merge.
+            if (merge_next && next != top) {
+                zone_of(next).remove(node::assume_free(next));
+                --m_indexed;
+            }
+            if (merge_prev && prev != top) {
+                zone_of(prev).remove(node::assume_free(prev));
+                --m_indexed;
+            }
+
+            if (merge_next) {
+                node->merge_next();
+            }
+            m_top = node;
+            if (merge_prev) {
+                m_top = node::assume_free(prev);
+                m_top->merge_next();
+            }
+            m_top->set_allocated();
+        }
+
+        header * top_header() const noexcept
+        {
+            return m_top ? &m_top->m_header : nullptr;
+        }
+
+        // Free nodes below the top node and above it are indexed apart.
+        index & zone(bool above) noexcept
+        {
+            return above ? m_upper_index : m_index;
+        }
+
+        index & zone_of(const header * h) noexcept
+        {
+            auto boundary = m_top ? m_top->address() : m_boundary;
+            return zone(reinterpret_cast<const std::byte *>(h) > boundary);
+        }
+
+        // Hands out a block that was kept allocated.
+        static header * reuse(node * p) noexcept
+        {
+            auto header = p->m_header;
+            return ::new (static_cast<void *>(p))
+                typename node::header(header, typename node::launder{});
+        }
+
+        void release(node * node) noexcept
+        {
+            node->set_free();
+
+            auto prev = node->prev();
+            auto merge_prev = prev && prev->is_free();
+
+            // Grow the top node back over a block next to it, or over
+            // the block it was last carved into.
+            if (auto next = node->next(), top = top_header();
+                top ? prev == top || next == top
+                    : node->address() == m_boundary) {
+                grow_top(node, prev, next);
+                return;
+            }
+
+            // Neighbours are on the same side of the top node.
+            auto & free = zone_of(&node->m_header);
+
+            // Absorb a free next node, taking its place
+            // unless merging into the previous node.
+            if (auto next = node->next(); next && next->is_free()) {
+                auto free_next = node::assume_free(next);
+                node->merge_next();
+                if (!merge_prev) {
+                    free.replace(free_next, node, free_next->size());
+                    return;
+                }
+                free.remove(free_next);
+                --m_indexed;
+            }
+
+            // Merge into a free previous node in place.
+            if (merge_prev) {
+                auto free_prev = node::assume_free(prev);
+                auto size = free_prev->size();
+                free_prev->merge_next();
+                free.resize(free_prev, size);
+                return;
+            }
+
+            free.insert(node);
+            ++m_indexed;
+        }
+
+        std::size_t allocation_size(const header * header) const noexcept
+        {
+            return data_size(header);
+        }
+
+        std::size_t free_count() const noexcept
+        {
+            std::size_t count = m_top ? 1 : 0;
+            for (header * p = &m_first->m_header; p; p = p->next()) {
+                if (p->is_free()) {
+                    ++count;
+                }
+            }
+            return count;
+        }
+
+        std::size_t largest_free() const noexcept
+        {
+            std::size_t largest = m_top ? m_top->size() : 0;
+            for (header * p = &m_first->m_header; p; p = p->next()) {
+                if (p->is_free() && p->size() > largest) {
+                    largest = p->size();
+                }
+            }
+            return largest;
+        }
+
+        void move_fast_bins(list & other) noexcept
+        {
+            for (std::size_t i = 0; i < fast_bin_count; ++i) {
+                m_fast_bins[i] = other.m_fast_bins[i];
+                other.m_fast_bins[i] = nullptr;
+            }
+        }
+
+        index m_index{};
+        index m_upper_index{};
+        node * m_first{};
+        node * m_top{};
+        node * m_pending{};
+        std::size_t m_indexed{};
+        std::byte * m_boundary{};
+        std::byte * m_zero_begin{};
+        std::byte * m_zero_end{};
+        node * m_fast_bins[fast_bin_count]{};
+    };
+
+    explicit basic_heap(std::byte * memory, std::size_t size) noexcept :
+        m_memory(region(memory, size)),
+        m_list(m_memory)
+    {
+    }
+
+    basic_heap(std::byte * memory, std::size_t size, zero_filled) noexcept :
+        m_memory(region(memory, size)),
+        m_list(m_memory, m_memory.data(), m_memory.data() + m_memory.size())
+    {
+    }
+
+    // Called with its context and without the lock held when an
+    // allocation fails, the allocation is retried as long as the handler
+    // returns true. The handler may free memory of the heap, such as by
+    // evicting caches, or wait for other threads to free it.
+    using failure_handler = bool (*)(void * context, std::size_t size);
+
+    void set_failure_handler(failure_handler handler,
+                             void * context = nullptr) const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        m_failure_handler = handler;
+        m_failure_context = context;
+    }
+
+    std::byte * allocate(std::size_t size,
+                         lifetime hint = lifetime::long_lived) const noexcept
+    {
+        auto header = allocate_header(
+            size, [&] { return m_list.allocate(size, hint); });
+        if (!header) {
+            return nullptr;
+        }
+        return ::new (list::data(header))
+            std::byte[list::data_size(header)];
+    }
+
+    // Allocates a zero filled block, clearing only the bytes that are
+    // not known to be zero, so that blocks carved out of a zero filled
+    // heap for the first time are not cleared at all.
+    std::byte * allocate_zeroed(
+        std::size_t size, lifetime hint = lifetime::long_lived) const noexcept
+    {
+        std::byte * zero_begin{};
+        std::byte * zero_end{};
+        auto header = allocate_header(size, [&] {
+            zero_begin = m_list.m_zero_begin;
+            zero_end = m_list.m_zero_end;
+            return m_list.allocate(size, hint);
+        });
+        if (!header) {
+            return nullptr;
+        }
+        auto data = ::new (list::data(header))
+            std::byte[list::data_size(header)];
+        auto end = data + list::data_size(header);
+
+        // Clear around the part of the block that is known to be zero.
+        if (zero_begin < zero_end && data < zero_end && zero_begin < end) {
+            if (data < zero_begin) {
+                std::memset(data, 0, zero_begin - data);
+            }
+            if (zero_end < end) {
+                std::memset(zero_end, 0, end - zero_end);
+            }
+        } else {
+            std::memset(data, 0, end - data);
+        }
+        return data;
+    }
+
+    // Allocates close to the block of a pointer previously returned by
+    // this heap that is still allocated, such as the parent of a tree
+    // node, or anywhere if none of the nearby blocks fits or the hint is
+    // not the data of a block.
+    std::byte * allocate_near(const void * hint,
+                              std::size_t size) const noexcept
+    {
+        if (!hint || !contains(hint)) {
+            return allocate(size);
+        }
+        auto header = allocate_header(size, [&] {
+            if (auto near = m_list.block_at(
+                    static_cast<const std::byte *>(hint), m_memory)) {
+                return m_list.allocate_near(near, size);
+            }
+            return m_list.allocate(size, lifetime::long_lived);
+        });
+        if (!header) {
+            return nullptr;
+        }
+        return ::new (list::data(header))
+            std::byte[list::data_size(header)];
+    }
+
+    void deallocate(std::byte * pointer, std::size_t size) const noexcept
+    {
+        if (!pointer) {
+            return;
+        }
+        auto header = list::from_data(pointer);
+        guard<LockPolicy> lock(m_lock);
+        m_stats.on_deallocate(header->size());
+        m_list.deallocate(header, size);
+    }
+
+    std::size_t allocation_size(const void * pointer) const noexcept
+    {
+        return m_list.allocation_size(
+            list::from_data(static_cast<const std::byte *>(pointer)));
+    }
+
+    bool contains(const void * address) const noexcept
+    {
+        return &m_memory.front() <= address && address < &m_memory.back();
+    }
+
+    std::size_t allocated() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        return m_stats.allocated();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_memory.size();
+    }
+
+    std::size_t free_nodes() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        return m_list.free_count();
+    }
+
+    std::size_t largest_free_node() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        return m_list.largest_free();
+    }
+
+    // Merges the blocks held back from coalescing into the free nodes.
+    void consolidate() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        m_list.consolidate();
+    }
+
+    // Frees everything at once in constant time, by starting over with
+    // the whole region as the top node. Nothing is destroyed, so the
+    // objects must be trivially destructible or already destroyed.
+    void reset() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        m_list = list(m_memory, m_list.m_zero_begin, m_list.m_zero_end);
+        m_stats = StatsPolicy{};
+    }
+
+    // Creates a child heap over a block of this heap, the whole block
+    // is returned to this heap when the child is destroyed.
+    subheap<basic_heap> make_subheap(std::size_t size) const noexcept
+    {
+        return subheap<basic_heap>(*this, size);
+    }
+
+private:
+    // Allocates under the lock, and calls the failure handler without
+    // the lock held until the allocation succeeds or the handler gives
+    // up.
+    template <typename Allocate>
+    typename list::header * allocate_header(std::size_t size,
+                                            Allocate allocate) const noexcept
+    {
+        while (true) {
+            failure_handler handler{};
+            void * context{};
+            {
+                guard<LockPolicy> lock(m_lock);
+                if (auto header = allocate()) {
+                    m_stats.on_allocate(header->size());
+                    return header;
+                }
+                handler = m_failure_handler;
+                context = m_failure_context;
+            }
+            if (!handler || !handler(context, size)) {
+                return nullptr;
+            }
+        }
+    }
+
+    static span<std::byte> region(std::byte * memory,
+                                  std::size_t size) noexcept
+    {
+        // Place the first header such that the data following
+        // it is aligned, all block sizes keep it that way.
+        auto offset = list::node::alignment(
+            reinterpret_cast<std::uintptr_t>(memory) +
+            sizeof(typename list::header));
+        size = (size - offset) / min_align * min_align;
+        if (size > list::header::max_size) {
+            size = list::header::max_size;
+        }
+        return {memory + offset, size};
+    }
+
+    span<std::byte> m_memory;
+    mutable list m_list;
+    mutable LockPolicy m_lock;
+    mutable StatsPolicy m_stats;
+    mutable failure_handler m_failure_handler{};
+    mutable void * m_failure_context{};
+};
+
+// Owns a child heap over a block allocated from a parent heap, and frees
+// the block in one deallocation when destroyed, together with everything
+// that is still allocated from the child. The child heap object lives at
+// the start of the block, so that moving the owner does not move it.
+// Empty if the parent could not allocate the block.
+template <typename Heap>
+class subheap
+{
+public:
+    subheap(const Heap & parent, std::size_t size) noexcept :
+        m_parent(&parent)
+    {
+        // The child region holds at least a free node.
+        if (size < Heap::list::node::min_size()) {
+            size = Heap::list::node::min_size();
+        }
+        if (size > ~std::size_t{} - overhead) {
+            return;
+        }
+        m_size = size + overhead;
+        m_block = parent.allocate(m_size);
+        if (!m_block) {
+            return;
+        }
+
+        auto available = parent.allocation_size(m_block);
+        auto offset = (alignof(Heap) - reinterpret_cast<std::uintptr_t>(
+                                           m_block) % alignof(Heap)) %
+                      alignof(Heap);
+        m_heap = ::new (m_block + offset)
+            Heap(m_block + offset + sizeof(Heap),
+                 available - offset - sizeof(Heap));
+    }
+
+    subheap(subheap && other) noexcept :
+        m_parent(other.m_parent),
+        m_block(std::exchange(other.m_block, nullptr)),
+        m_heap(std::exchange(other.m_heap, nullptr)),
+        m_size(other.m_size)
+    {
+    }
+
+    subheap & operator=(subheap && other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            m_parent = other.m_parent;
+            m_block = std::exchange(other.m_block, nullptr);
+            m_heap = std::exchange(other.m_heap, nullptr);
+            m_size = other.m_size;
+        }
+        return *this;
+    }
+
+    subheap(const subheap &) = delete;
+    subheap & operator=(const subheap &) = delete;
+
+    ~subheap()
+    {
+        reset();
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_heap;
+    }
+
+    const Heap & operator*() const noexcept
+    {
+        return *m_heap;
+    }
+
+    const Heap * operator->() const noexcept
+    {
+        return m_heap;
+    }
+
+private:
+    // The child heap object and its alignment padding, and the padding
+    // that aligns the first block of the child.
+    constexpr static std::size_t overhead =
+        sizeof(Heap) + alignof(Heap) - 1 + Heap::min_align - 1;
+
+    void reset() noexcept
+    {
+        if (!m_block) {
+            return;
+        }
+        std::exchange(m_heap, nullptr)->~Heap();
+        m_parent->deallocate(std::exchange(m_block, nullptr), m_size);
+    }
+
+    const Heap * m_parent{};
+    std::byte * m_block{};
+    Heap * m_heap{};
+    std::size_t m_size{};
+};
+
+template <typename Links, std::size_t Alignment = alignof(std::max_align_t)>
+using basic_allocator =
+    basic_heap<first_fit, Links, no_lock, basic_stats, Alignment>;
+
+template <std::size_t Alignment>
+class allocator<std::byte, Alignment>
+    : public basic_heap<first_fit, pointer_links, no_lock, basic_stats, Alignment>
+{
+public:
+    using value_type = std::byte;
+    using basic_heap<first_fit, pointer_links, no_lock, basic_stats, Alignment>::basic_heap;
+};
+
+// A heap that keeps all block metadata out of band, so that blocks are
+// packed at granule granularity without headers. The region starts with
+// a table of one 32 bit entry per granule and a bitmap of the granules
+// that start a free block, followed by the data. A block records its size
+// in the entries of its first and last granule, and allocation scans the
+// bitmap and the table only, never touching the data.
+template <std::size_t Granularity = alignof(std::max_align_t),
+          typename LockPolicy = no_lock,
+          typename StatsPolicy = basic_stats>
+class out_of_band_heap
+{
+public:
+    constexpr static std::size_t min_align = Granularity;
+
+    static_assert(Granularity && !(Granularity & (Granularity - 1)),
+                  "Granularity must be a power of two.");
+
+    explicit out_of_band_heap(std::byte * memory, std::size_t size) noexcept
+    {
+        auto offset = padding(reinterpret_cast<std::uintptr_t>(memory),
+                              alignof(std::uint64_t));
+        if (size <= offset) {
+            return;
+        }
+        size -= offset;
+        memory += offset;
+
+        // Each granule costs its data, a table entry and a bitmap bit.
+        auto granules = size * 8 / (Granularity * 8 + sizeof(entry) * 8 + 1);
+        if (granules > max_granules) {
+            granules = max_granules;
+        }
+        while (granules && layout_size(granules) > size) {
+            --granules;
+        }
+        if (!granules) {
+            return;
+        }
+
+        auto words = (granules + 63) / 64;
+        m_table = std::uninitialized_default_construct_n(
+            reinterpret_cast<entry *>(memory), granules) - granules;
+        m_bitmap = reinterpret_cast<std::uint64_t *>(
+            memory + table_size(granules));
+        std::uninitialized_value_construct_n(m_bitmap, words);
+        m_data = memory + table_size(granules) + words * sizeof(std::uint64_t);
+        m_data += padding(reinterpret_cast<std::uintptr_t>(m_data),
+                          Granularity);
+        m_granules = granules;
+
+        make_free(0, granules);
+    }
+
+    std::byte * allocate(std::size_t size) const noexcept
+    {
+        if (!size) {
+            size = 1;
+        }
+        if (size > m_granules * Granularity) {
+            return nullptr;
+        }
+        auto count = (size + Granularity - 1) / Granularity;
+
+        guard<LockPolicy> lock(m_lock);
+        for (auto start = next_free(0); start < m_granules;
+             start = next_free(start + 1)) {
+            auto available = granules(start);
+            if (available < count) {
+                continue;
+            }
+
+            // The leftover becomes a free block of its own.
+            clear_free(start);
+            if (available > count) {
+                make_free(start + count, available - count);
+            }
+            mark(start, count, allocated_bit);
+
+            m_stats.on_allocate(count * Granularity);
+            return ::new (m_data + start * Granularity)
+                std::byte[count * Granularity];
+        }
+        return nullptr;
+    }
+
+    void deallocate(std::byte * pointer, std::size_t) const noexcept
+    {
+        if (!pointer) {
+            return;
+        }
+
+        auto start = granule(pointer);
+        guard<LockPolicy> lock(m_lock);
+        auto count = granules(start);
+        m_stats.on_deallocate(count * Granularity);
+
+        // Merge with a free next block.
+        if (auto next = start + count;
+            next < m_granules && !(m_table[next] & allocated_bit)) {
+            clear_free(next);
+            count += granules(next);
+        }
+
+        // Merge with a free previous block, whose last
+        // granule entry precedes this block.
+        if (start && !(m_table[start - 1] & allocated_bit)) {
+            auto previous = start - (m_table[start - 1] >> 1);
+            clear_free(previous);
+            count += start - previous;
+            start = previous;
+        }
+
+        make_free(start, count);
+    }
+
+    std::size_t allocation_size(const void * pointer) const noexcept
+    {
+        return granules(granule(pointer)) * Granularity;
+    }
+
+    bool contains(const void * address) const noexcept
+    {
+        return m_data <= address && address < m_data + size();
+    }
+
+    std::size_t allocated() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        return m_stats.allocated();
+    }
+
+    std::size_t size() const noexcept
+    {
+        return m_granules * Granularity;
+    }
+
+    std::size_t free_nodes() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        std::size_t count{};
+        for (auto start = next_free(0); start < m_granules;
+             start = next_free(start + 1)) {
+            ++count;
+        }
+        return count;
+    }
+
+    std::size_t largest_free_node() const noexcept
+    {
+        guard<LockPolicy> lock(m_lock);
+        std::size_t largest{};
+        for (auto start = next_free(0); start < m_granules;
+             start = next_free(start + 1)) {
+            if (granules(start) > largest) {
+                largest = granules(start);
+            }
+        }
+        return largest * Granularity;
+    }
+
+private:
+    // The granule count shifted left by one, and the allocated bit.
+    using entry = std::uint32_t;
+
+    constexpr static entry allocated_bit = 0x1;
+    constexpr static std::size_t max_granules = ~entry{} >> 1;
+
+    constexpr static std::size_t padding(std::uintptr_t value,
+                                         std::size_t alignment) noexcept
+    {
+        return (alignment - value % alignment) % alignment;
+    }
+
+    constexpr static std::size_t table_size(std::size_t granules) noexcept
+    {
+        return granules * sizeof(entry) +
+               padding(granules * sizeof(entry), alignof(std::uint64_t));
+    }
+
+    constexpr static std::size_t layout_size(std::size_t granules) noexcept
+    {
+        return table_size(granules) +
+               (granules + 63) / 64 * sizeof(std::uint64_t) +
+               (Granularity - 1) + granules * Granularity;
+    }
+
+    std::size_t granule(const void * pointer) const noexcept
+    {
+        return static_cast<std::size_t>(
+                   static_cast<const std::byte *>(pointer) - m_data) /
+               Granularity;
+    }
+
+    std::size_t granules(std::size_t start) const noexcept
+    {
+        return m_table[start] >> 1;
+    }
+
+    void mark(std::size_t start, std::size_t count, entry flags) const noexcept
+    {
+        auto value = static_cast<entry>(count << 1) | flags;
+        m_table[start] = value;
+        m_table[start + count - 1] = value;
+    }
+
+    void make_free(std::size_t start, std::size_t count) const noexcept
+    {
+        mark(start, count, 0);
+        m_bitmap[start / 64] |= std::uint64_t{1} << (start % 64);
+    }
+
+    void clear_free(std::size_t start) const noexcept
+    {
+        m_bitmap[start / 64] &= ~(std::uint64_t{1} << (start % 64));
+    }
+
+    // Returns the first free block that starts at or after the given
+    // granule, or the granule count if there is none.
+    std::size_t next_free(std::size_t start) const noexcept
+    {
+        if (start >= m_granules) {
+            return m_granules;
+        }
+
+        auto word = start / 64;
+        auto bits = m_bitmap[word] & (~std::uint64_t{} << (start % 64));
+        auto words = (m_granules + 63) / 64;
+        while (!bits) {
+            if (++word == words) {
+                return m_granules;
+            }
+            bits = m_bitmap[word];
+        }
+
+#if defined(__GNUC__) || defined(__clang__)
+        return word * 64 + __builtin_ctzll(bits);
+#else
+        std::size_t bit{};
+        while (!(bits & 0x1)) {
+            bits >>= 1;
+            ++bit;
+        }
+        return word * 64 + bit;
+#endif
+    }
+
+    entry * m_table{};
+    std::uint64_t * m_bitmap{};
+    std::byte * m_data{};
+    std::size_t m_granules{};
+    mutable LockPolicy m_lock;
+    mutable StatsPolicy m_stats;
+};
+
+template <typename Type, std::size_t Alignment>
+class allocator
+{
+public:
+    using value_type = Type;
+
+    constexpr explicit allocator(std::byte * data, std::size_t size) :
+        m_allocator(data, size)
+    {
+    }
+
+    Type * allocate(std::size_t size) const noexcept
+    {
+        return std::launder(reinterpret_cast<Type *>(
+            m_allocator.allocate(sizeof(Type) * size)));
+    }
+
+    void deallocate(Type * pointer, std::size_t size) const noexcept
+    {
+        return m_allocator.deallocate(
+            reinterpret_cast<std::byte *>(pointer), sizeof(Type) * size);
+    }
+
+    std::size_t allocation_size(const void * pointer) const noexcept
+    {
+        return m_allocator.allocation_size(pointer);
+    }
+
+    bool contains(const void * pointer) const noexcept
+    {
+        return m_allocator.contains(pointer);
+    }
+
+private:
+    allocator<std::byte, Alignment> m_allocator;
+};
+
+template <std::size_t Index = 0, typename Allocator = allocator<std::byte>>
+class heap
+{
+public:
+    using allocator_type = Allocator;
+
+    static void create(std::byte * memory, std::size_t size) noexcept
+    {
+        ::new (std::addressof(m_allocator)) allocator_type(memory, size);
+    }
+
+    static void
+    create(std::byte * memory, std::size_t size, zero_filled) noexcept
+    {
+        ::new (std::addressof(m_allocator))
+            allocator_type(memory, size, zero_filled{});
+    }
+
+    static const allocator_type & get_allocator() noexcept
+    {
+        return *std::launder(reinterpret_cast<allocator_type *>(
+            std::addressof(m_allocator)));
+    }
+
+private:
+    static inline std::aligned_storage_t<sizeof(allocator_type),
+                                         alignof(allocator_type)>
+        m_allocator;
+};
+
+// Allocates from the source with the given lifetime hint, sources
+// other than basic_heap are used with the default hint only.
+template <typename Type,
+          typename Source = heap<>,
+          lifetime Lifetime = lifetime::long_lived>
+class static_allocator
+{
+public:
+    using value_type = Type;
+
+    template <typename Other>
+    struct rebind
+    {
+        using other = static_allocator<Other, Source, Lifetime>;
+    };
+
+    constexpr static_allocator() noexcept = default;
+
+    template <typename Other>
+    constexpr static_allocator(
+        const static_allocator<Other, Source, Lifetime> &) noexcept
+    {
+    }
+
+    Type * allocate(std::size_t size) noexcept
+    {
+        if constexpr (Lifetime == lifetime::long_lived) {
+            return std::launder(reinterpret_cast<Type *>(
+                Source::get_allocator().allocate(sizeof(Type) * size)));
+        } else {
+            return std::launder(
+                reinterpret_cast<Type *>(Source::get_allocator().allocate(
+                    sizeof(Type) * size, Lifetime)));
+        }
+    }
+
+    void deallocate(Type * pointer, std::size_t size) noexcept
+    {
+        return Source::get_allocator().deallocate(
+            reinterpret_cast<std::byte *>(pointer), sizeof(Type) * size);
+    }
+
+    template <typename Other>
+    constexpr bool operator==(
+        const static_allocator<Other, Source, Lifetime> &) const noexcept
+    {
+        return true;
+    }
+
+    template <typename Other>
+    constexpr bool operator!=(
+        const static_allocator<Other, Source, Lifetime> &) const noexcept
+    {
+        return false;
+    }
+};
+
+// Block alignment of a source, sources that do not tell are taken to
+// align as std::max_align_t.
+template <typename Source, typename = void>
+struct source_alignment
+    : std::integral_constant<std::size_t, alignof(std::max_align_t)>
+{
+};
+
+template <typename Source>
+struct source_alignment<
+    Source,
+    std::void_t<decltype(std::decay_t<
+                         decltype(Source::get_allocator())>::min_align)>>
+    : std::integral_constant<
+          std::size_t,
+          std::decay_t<decltype(Source::get_allocator())>::min_align>
+{
+};
+
+// Base of coroutine promise types that allocates the coroutine frames
+// from the source instead of the global operator new. Frames that the
+// source cannot serve are allocated with the global operator new.
+template <typename Source = heap<>, lifetime Lifetime = lifetime::long_lived>
+struct pooled_promise
+{
+    static_assert(source_alignment<Source>::value >=
+                      __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+                  "Coroutine frames need the alignment of operator new.");
+
+    static void * operator new(std::size_t size)
+    {
+        std::byte * pointer{};
+        if constexpr (Lifetime == lifetime::long_lived) {
+            pointer = Source::get_allocator().allocate(size);
+        } else {
+            pointer = Source::get_allocator().allocate(size, Lifetime);
+        }
+        if (pointer) {
+            return pointer;
+        }
+        return ::operator new(size);
+    }
+
+    static void operator delete(void * pointer, std::size_t size) noexcept
+    {
+        if (Source::get_allocator().contains(pointer)) {
+            return Source::get_allocator().deallocate(
+                static_cast<std::byte *>(pointer), size);
+        }
+        ::operator delete(pointer, size);
+    }
+};
 
-            // Count deallocation.
-            m_allocated -= node->size();
+// Byte budget of a subsystem named by a tag type. Every thread reserves
+// bytes from the budget in batches and counts its allocations against
+// its own reservation, so that the shared counter is touched only once
+// per batch. Batches are capped by the room left below the soft and hard
+// limits, and when a reservation does not fit, the unused reservations of
+// all threads are taken back before deciding, so that the watermark
+// handler is called when the allocated bytes cross the soft limit, and
+// only allocations that would take them past the hard limit are refused.
+template <typename Tag>
+class budget
+{
+public:
+    using watermark_handler = void (*)(std::size_t allocated);
+
+    constexpr static std::size_t batch = 64 * 1024;
+
+    static void set_limits(std::size_t soft, std::size_t hard) noexcept
+    {
+        m_soft.store(soft, std::memory_order_relaxed);
+        m_hard.store(hard, std::memory_order_relaxed);
+    }
+
+    static watermark_handler
+    set_watermark_handler(watermark_handler handler) noexcept
+    {
+        return m_handler.exchange(handler);
+    }
+
+    // Bytes reserved by all threads, which is above the bytes allocated
+    // by up to two batches per thread.
+    static std::size_t reserved() noexcept
+    {
+        return m_reserved.load(std::memory_order_relaxed);
+    }
+
+    // Bytes allocated by all threads, the reservations without the parts
+    // that the threads did not use yet.
+    static std::size_t allocated() noexcept
+    {
+        guard<spin_lock> lock(m_lock);
+        auto allocated = m_reserved.load(std::memory_order_relaxed);
+        for (auto thread = m_threads; thread; thread = thread->m_next) {
+            allocated -= thread->m_credit.load(std::memory_order_relaxed);
+        }
+        return allocated;
+    }
+
+    static bool acquire(std::size_t size) noexcept
+    {
+        auto & local = this_thread();
+        auto credit = local.m_credit.load(std::memory_order_relaxed);
+        while (credit >= size) {
+            if (local.m_credit.compare_exchange_weak(
+                    credit, credit - size, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+
+        // Whatever credit is left stays with the thread.
+        auto amount = reserve(size);
+        if (!amount) {
+            return false;
+        }
+        local.m_credit.fetch_add(amount - size, std::memory_order_relaxed);
+        return true;
+    }
+
+    static void release(std::size_t size) noexcept
+    {
+        auto & local = this_thread();
+        auto credit =
+            local.m_credit.fetch_add(size, std::memory_order_relaxed) + size;
+        while (credit > 2 * batch) {
+            if (local.m_credit.compare_exchange_weak(
+                    credit, batch, std::memory_order_relaxed)) {
+                m_reserved.fetch_sub(credit - batch,
+                                     std::memory_order_relaxed);
+                return;
+            }
+        }
+    }
+
+private:
+    // The reservation of a thread, which is registered so that it can be
+    // taken back by other threads, and returned when the thread exits.
+    struct local
+    {
+        local() noexcept
+        {
+            guard<spin_lock> lock(m_lock);
+            m_next = m_threads;
+            m_threads = this;
+        }
 
-            // Find first free node.
-            for (auto p = node->prev(); p; p = p->m_prev) {
-                if (!p->is_free()) {
-                    continue;
+        ~local()
+        {
+            {
+                guard<spin_lock> lock(m_lock);
+                auto link = &m_threads;
+                while (*link != this) {
+                    link = &(*link)->m_next;
                 }
-                node::assume_free(p)->append_to_freelist(node);
-                return;
+                *link = m_next;
             }
+            m_reserved.fetch_sub(m_credit.exchange(0),
+                                 std::memory_order_relaxed);
+        }
 
-            // If this is not the last node, prepend to first.
-            if (m_first_free) {
-                m_first_free->prepend_to_freelist(node);
-            } else {
-                node->m_next_free = {};
-                node->m_prev_free = {};
+        std::atomic<std::size_t> m_credit{};
+        local * m_next{};
+    };
+
+    static local & this_thread() noexcept
+    {
+        thread_local local local;
+        return local;
+    }
+
+    // Takes back the unused reservations of all threads.
+    static void reclaim() noexcept
+    {
+        guard<spin_lock> lock(m_lock);
+        for (auto thread = m_threads; thread; thread = thread->m_next) {
+            m_reserved.fetch_sub(thread->m_credit.exchange(0),
+                                 std::memory_order_relaxed);
+        }
+    }
+
+    // Reserves a batch, capped by the room below the next limit, or the
+    // needed bytes if they are more, and returns the bytes reserved, zero
+    // if the needed bytes do not fit even without the unused reservations.
+    static std::size_t reserve(std::size_t needed) noexcept
+    {
+        auto soft = m_soft.load(std::memory_order_relaxed);
+        auto hard = m_hard.load(std::memory_order_relaxed);
+        auto reserved = m_reserved.load(std::memory_order_relaxed);
+        auto reclaimed = false;
+        std::size_t amount{};
+        while (true) {
+            auto crosses = reserved < soft && soft - reserved <= needed;
+            auto fits = reserved <= hard && needed <= hard - reserved;
+            if (!reclaimed && (crosses || !fits)) {
+                reclaim();
+                reclaimed = true;
+                reserved = m_reserved.load(std::memory_order_relaxed);
+                continue;
+            }
+            if (!fits) {
+                return 0;
+            }
+
+            // Below the soft limit reservations stay short of it, so that
+            // only the allocations themselves reach it.
+            auto room = hard - reserved;
+            if (!crosses && reserved < soft && soft - reserved - 1 < room) {
+                room = soft - reserved - 1;
+            }
+            amount = needed < batch && needed < room
+                         ? (batch < room ? batch : room)
+                         : needed;
+            if (m_reserved.compare_exchange_weak(
+                    reserved, reserved + amount, std::memory_order_relaxed)) {
+                break;
             }
-            m_first_free = node;
         }
 
-        std::size_t allocation_size(const node::header * header) const noexcept
-        {
-            return header->data_size();
+        // The unused reservations were just taken back, so the bytes
+        // reserved are the bytes allocated.
+        if (reserved < soft && soft - reserved <= needed) {
+            if (auto handler = m_handler.load()) {
+                handler(reserved + needed);
+            }
         }
+        return amount;
+    }
 
-        mutable node * m_first_free{};
-        mutable std::size_t m_allocated{};
-        node * m_first{};
+    inline static std::atomic<std::size_t> m_reserved{};
+    inline static std::atomic<std::size_t> m_soft{~std::size_t{}};
+    inline static std::atomic<std::size_t> m_hard{~std::size_t{}};
+    inline static std::atomic<watermark_handler> m_handler{};
+    inline static spin_lock m_lock;
+    inline static local * m_threads{};
+};
+
+// Allocates from the source on the budget of the tag, refusing the
+// allocations past its hard limit.
+template <typename Type, typename Tag, typename Source = heap<>>
+class budgeted_allocator
+{
+public:
+    using value_type = Type;
+
+    template <typename Other>
+    struct rebind
+    {
+        using other = budgeted_allocator<Other, Tag, Source>;
     };
 
-    using value_type = std::byte;
+    constexpr budgeted_allocator() noexcept = default;
 
-    explicit allocator(std::byte * memory, std::size_t size) noexcept :
-        m_memory{memory + list::node::alignment(
-                              reinterpret_cast<std::uintptr_t>(memory)),
-                 size - list::node::alignment(
-                            reinterpret_cast<std::uintptr_t>(memory))},
-        m_list(m_memory)
+    template <typename Other>
+    constexpr budgeted_allocator(
+        const budgeted_allocator<Other, Tag, Source> &) noexcept
+    {
+    }
+
+    Type * allocate(std::size_t size) noexcept
+    {
+        auto bytes = sizeof(Type) * size;
+        if (!budget<Tag>::acquire(bytes)) {
+            return nullptr;
+        }
+        auto pointer = Source::get_allocator().allocate(bytes);
+        if (!pointer) {
+            budget<Tag>::release(bytes);
+            return nullptr;
+        }
+        return std::launder(reinterpret_cast<Type *>(pointer));
+    }
+
+    void deallocate(Type * pointer, std::size_t size) noexcept
+    {
+        auto bytes = sizeof(Type) * size;
+        Source::get_allocator().deallocate(
+            reinterpret_cast<std::byte *>(pointer), bytes);
+        budget<Tag>::release(bytes);
+    }
+
+    template <typename Other>
+    constexpr bool operator==(
+        const budgeted_allocator<Other, Tag, Source> &) const noexcept
     {
+        return true;
     }
 
+    template <typename Other>
+    constexpr bool operator!=(
+        const budgeted_allocator<Other, Tag, Source> &) const noexcept
+    {
+        return false;
+    }
+};
+
+// Building blocks compose sources, types with a static get_allocator()
+// such as heap<Index>, into new sources with the same surface.
+
+// Allocates from the primary source, and from the secondary
+// source if the primary source is exhausted.
+template <typename Primary, typename Secondary>
+class fallback
+{
+public:
     std::byte * allocate(std::size_t size) const noexcept
     {
-        auto header = m_list.allocate(size);
-        if (!header) {
+        if (auto pointer = Primary::get_allocator().allocate(size)) {
+            return pointer;
+        }
+        return Secondary::get_allocator().allocate(size);
+    }
+
+    void deallocate(std::byte * pointer, std::size_t size) const noexcept
+    {
+        if (Primary::get_allocator().contains(pointer)) {
+            return Primary::get_allocator().deallocate(pointer, size);
+        }
+        Secondary::get_allocator().deallocate(pointer, size);
+    }
+
+    std::size_t allocation_size(const void * pointer) const noexcept
+    {
+        if (Primary::get_allocator().contains(pointer)) {
+            return Primary::get_allocator().allocation_size(pointer);
+        }
+        return Secondary::get_allocator().allocation_size(pointer);
+    }
+
+    bool contains(const void * pointer) const noexcept
+    {
+        return Primary::get_allocator().contains(pointer) ||
+               Secondary::get_allocator().contains(pointer);
+    }
+
+    static const fallback & get_allocator() noexcept
+    {
+        static constexpr fallback allocator{};
+        return allocator;
+    }
+};
+
+// Allocates sizes up to the threshold from the small source,
+// and larger sizes from the large source.
+template <std::size_t Threshold, typename Small, typename Large>
+class segregator
+{
+public:
+    std::byte * allocate(std::size_t size) const noexcept
+    {
+        if (size <= Threshold) {
+            return Small::get_allocator().allocate(size);
+        }
+        return Large::get_allocator().allocate(size);
+    }
+
+    void deallocate(std::byte * pointer, std::size_t size) const noexcept
+    {
+        if (size <= Threshold) {
+            return Small::get_allocator().deallocate(pointer, size);
+        }
+        Large::get_allocator().deallocate(pointer, size);
+    }
+
+    std::size_t allocation_size(const void * pointer) const noexcept
+    {
+        if (Small::get_allocator().contains(pointer)) {
+            return Small::get_allocator().allocation_size(pointer);
+        }
+        return Large::get_allocator().allocation_size(pointer);
+    }
+
+    bool contains(const void * pointer) const noexcept
+    {
+        return Small::get_allocator().contains(pointer) ||
+               Large::get_allocator().contains(pointer);
+    }
+
+    static const segregator & get_allocator() noexcept
+    {
+        static constexpr segregator allocator{};
+        return allocator;
+    }
+};
+
+// Stores a default constructed prefix object before every block and an
+// optional suffix object after it. The prefix is padded to keep the block
+// aligned to alignof(std::max_align_t).
+template <typename Source, typename Prefix, typename Suffix = void>
+class affix
+{
+public:
+    std::byte * allocate(std::size_t size) const noexcept
+    {
+        auto block = Source::get_allocator().allocate(block_size(size));
+        if (!block) {
             return nullptr;
         }
-        return ::new(header->data()) std::byte[header->data_size()];
+        ::new (static_cast<void *>(block)) Prefix();
+        if constexpr (!std::is_void_v<Suffix>) {
+            ::new (static_cast<void *>(block + suffix_offset(size))) Suffix();
+        }
+        return block + prefix_size;
     }
 
     void deallocate(std::byte * pointer, std::size_t size) const noexcept
@@ -446,114 +2823,459 @@ public:
         if (!pointer) {
             return;
         }
-        m_list.deallocate(list::node::header::from_data(pointer), size);
+        if constexpr (!std::is_void_v<Suffix>) {
+            suffix(pointer, size).~Suffix();
+        }
+        prefix(pointer).~Prefix();
+        Source::get_allocator().deallocate(pointer - prefix_size,
+                                           block_size(size));
     }
 
     std::size_t allocation_size(const void * pointer) const noexcept
     {
-        return m_list.allocation_size(list::node::header::from_data(
-            static_cast<const std::byte *>(pointer)));
+        // With a suffix the usable size is the requested size.
+        static_assert(std::is_void_v<Suffix>,
+                      "The allocation size of a block with a suffix is "
+                      "the requested size.");
+        return Source::get_allocator().allocation_size(
+                   static_cast<const std::byte *>(pointer) - prefix_size) -
+               prefix_size;
     }
 
-    bool contains(const void * address) const noexcept
+    bool contains(const void * pointer) const noexcept
     {
-        return &m_memory.front() <= address && address < &m_memory.back();
+        return Source::get_allocator().contains(pointer);
     }
 
-    std::size_t allocated() const noexcept
+    static Prefix & prefix(std::byte * pointer) noexcept
     {
-        return m_list.m_allocated;
+        return *std::launder(
+            reinterpret_cast<Prefix *>(pointer - prefix_size));
     }
 
-    std::size_t size() const noexcept
+    template <typename Type = Suffix>
+    static Type & suffix(std::byte * pointer, std::size_t size) noexcept
     {
-        return m_memory.size();
+        return *std::launder(reinterpret_cast<Type *>(
+            pointer - prefix_size + suffix_offset(size)));
+    }
+
+    static const affix & get_allocator() noexcept
+    {
+        static constexpr affix allocator{};
+        return allocator;
     }
 
 private:
-    span<std::byte> m_memory;
-    list m_list;
+    constexpr static std::size_t round(std::size_t size,
+                                       std::size_t alignment) noexcept
+    {
+        return (size + alignment - 1) / alignment * alignment;
+    }
+
+    constexpr static std::size_t suffix_offset(std::size_t size) noexcept
+    {
+        if constexpr (std::is_void_v<Suffix>) {
+            return prefix_size + size;
+        } else {
+            return prefix_size + round(size, alignof(Suffix));
+        }
+    }
+
+    constexpr static std::size_t block_size(std::size_t size) noexcept
+    {
+        if constexpr (std::is_void_v<Suffix>) {
+            return suffix_offset(size);
+        } else {
+            return suffix_offset(size) + sizeof(Suffix);
+        }
+    }
+
+    constexpr static std::size_t prefix_size =
+        round(sizeof(Prefix), alignof(std::max_align_t));
 };
 
-template <typename Type>
-class allocator
+// Allocates sizes in (Min, Max] from one source per step sized bucket,
+// bucket i being Source<i> which serves sizes up to Min + (i + 1) * Step.
+// Other sizes are not served, compose with a segregator or fallback.
+template <template <std::size_t> typename Source,
+          std::size_t Min,
+          std::size_t Max,
+          std::size_t Step>
+class bucketizer
 {
 public:
-    using value_type = Type;
+    static_assert(Step && Min < Max && (Max - Min) % Step == 0,
+                  "Buckets must evenly divide (Min, Max].");
 
-    constexpr explicit allocator(std::byte * data, std::size_t size) :
-        m_allocator(data, size)
-    {
-    }
+    constexpr static std::size_t buckets = (Max - Min) / Step;
 
-    Type * allocate(std::size_t size) const noexcept
+    std::byte * allocate(std::size_t size) const noexcept
     {
-        return std::launder(reinterpret_cast<Type *>(
-            m_allocator.allocate(sizeof(Type) * size)));
+        if (size <= Min || size > Max) {
+            return nullptr;
+        }
+        return allocate(size, bucket(size), buckets_sequence{});
     }
 
-    void deallocate(Type * pointer, std::size_t size) const noexcept
+    void deallocate(std::byte * pointer, std::size_t size) const noexcept
     {
-        return m_allocator.deallocate(
-            reinterpret_cast<std::byte *>(pointer), sizeof(Type) * size);
+        if (!pointer) {
+            return;
+        }
+        deallocate(pointer, size, bucket(size), buckets_sequence{});
     }
 
     std::size_t allocation_size(const void * pointer) const noexcept
     {
-        return m_allocator.allocation_size(pointer);
+        return allocation_size(pointer, buckets_sequence{});
     }
 
     bool contains(const void * pointer) const noexcept
     {
-        return m_allocator.contains(pointer);
+        return contains(pointer, buckets_sequence{});
+    }
+
+    static const bucketizer & get_allocator() noexcept
+    {
+        static constexpr bucketizer allocator{};
+        return allocator;
     }
 
 private:
-    allocator<std::byte> m_allocator;
+    using buckets_sequence = std::make_index_sequence<buckets>;
+
+    static std::size_t bucket(std::size_t size) noexcept
+    {
+        return (size - Min - 1) / Step;
+    }
+
+    template <std::size_t... Buckets>
+    static std::byte * allocate(std::size_t size,
+                                std::size_t bucket,
+                                std::index_sequence<Buckets...>) noexcept
+    {
+        std::byte * pointer{};
+        ((bucket == Buckets &&
+          (pointer = Source<Buckets>::get_allocator().allocate(size),
+           true)) ||
+         ...);
+        return pointer;
+    }
+
+    template <std::size_t... Buckets>
+    static void deallocate(std::byte * pointer,
+                           std::size_t size,
+                           std::size_t bucket,
+                           std::index_sequence<Buckets...>) noexcept
+    {
+        ((bucket == Buckets &&
+          (Source<Buckets>::get_allocator().deallocate(pointer, size),
+           true)) ||
+         ...);
+    }
+
+    template <std::size_t... Buckets>
+    static std::size_t allocation_size(const void * pointer,
+                                       std::index_sequence<Buckets...>) noexcept
+    {
+        std::size_t size{};
+        ((Source<Buckets>::get_allocator().contains(pointer) &&
+          (size = Source<Buckets>::get_allocator().allocation_size(pointer),
+           true)) ||
+         ...);
+        return size;
+    }
+
+    template <std::size_t... Buckets>
+    static bool contains(const void * pointer,
+                         std::index_sequence<Buckets...>) noexcept
+    {
+        return (Source<Buckets>::get_allocator().contains(pointer) || ...);
+    }
 };
 
-template <std::size_t Index = 0>
-class heap
+// Finds the heap that owns a pointer among heaps registered at run time
+// by the range of their memory, through a two level page map from the
+// 64KiB granules of the address space to the heap registered over them.
+// A heap nested in the memory of another, such as a sub-heap, owns the
+// granules it covers whole. Granules where the end of a heap meets
+// another heap are resolved under the lock by comparing the ranges of the
+// registered heaps, the innermost range owning a pointer.
+// Entries are read without the lock as sequence locks. Leaves of the page
+// map are allocated with the global operator new and are never freed.
+class registry
 {
 public:
-    using allocator_type = allocator<std::byte>;
+    constexpr static std::size_t capacity = 254;
+
+    // Registers a heap over the memory it was created with, returns
+    // false if the registry is full, out of memory for the page map, or
+    // the memory overlaps a registered heap without either of them being
+    // nested in the other.
+    template <typename Heap>
+    static bool
+    add(const Heap & heap, const void * memory, std::size_t size) noexcept
+    {
+        auto begin = reinterpret_cast<std::uintptr_t>(memory);
+        auto end = begin + size;
+        if (!size || end < begin || end - 1 > max_address) {
+            return false;
+        }
 
-    static void create(std::byte * memory, std::size_t size) noexcept
+        guard<spin_lock> lock(m_lock);
+        std::size_t index = capacity;
+        for (std::size_t i = 0; i < capacity; ++i) {
+            auto entry = m_entries[i].load();
+            if (!entry.m_heap) {
+                index = index == capacity ? i : index;
+                continue;
+            }
+            auto inner = entry.m_begin <= begin && end <= entry.m_end;
+            auto outer = begin <= entry.m_begin && entry.m_end <= end;
+            if (begin < entry.m_end && entry.m_begin < end &&
+                inner == outer) {
+                return false;
+            }
+        }
+        if (index == capacity) {
+            return false;
+        }
+
+        auto first = begin >> granule_shift;
+        auto last = (end - 1) >> granule_shift;
+        for (auto granule = first; granule <= last; ++granule) {
+            if (!leaf_of(granule, true)) {
+                return false;
+            }
+        }
+
+        m_entries[index].store({&heap, begin, end, &deallocate<Heap>});
+        for (auto granule = first; granule <= last; ++granule) {
+            auto & slot = slot_of(granule);
+            slot.store(slot.load(std::memory_order_relaxed) == empty
+                           ? static_cast<std::uint8_t>(index + 1)
+                           : owner_of(granule),
+                       std::memory_order_release);
+        }
+        return true;
+    }
+
+    static void remove(const void * heap) noexcept
     {
-        ::new (std::addressof(m_allocator)) allocator_type(memory, size);
+        guard<spin_lock> lock(m_lock);
+        for (std::size_t index = 0; index < capacity; ++index) {
+            auto entry = m_entries[index].load();
+            if (entry.m_heap != heap) {
+                continue;
+            }
+
+            auto first = entry.m_begin >> granule_shift;
+            auto last = (entry.m_end - 1) >> granule_shift;
+            m_entries[index].store({});
+            for (auto granule = first; granule <= last; ++granule) {
+                slot_of(granule).store(owner_of(granule),
+                                       std::memory_order_release);
+            }
+        }
     }
 
-    static const allocator_type & get_allocator() noexcept
+    // Returns the registered heap that owns the pointer, if any.
+    static const void * owner(const void * pointer) noexcept
     {
-        return *std::launder(reinterpret_cast<allocator_type *>(
-            std::addressof(m_allocator)));
+        auto entry = find(pointer);
+        return entry.m_heap;
+    }
+
+    // Deallocates a pointer allocated from any registered heap, returns
+    // false if no registered heap owns it.
+    static bool free(void * pointer) noexcept
+    {
+        auto entry = find(pointer);
+        if (!entry.m_heap) {
+            return false;
+        }
+        entry.m_deallocate(entry.m_heap, static_cast<std::byte *>(pointer));
+        return true;
     }
 
 private:
-    static inline std::aligned_storage_t<sizeof(allocator_type),
-                                         alignof(allocator_type)>
-        m_allocator;
-};
+    using deallocate_function = void (*)(const void *, std::byte *) noexcept;
 
-template <typename Type, typename Source = heap<>>
-class static_allocator
-{
-public:
-    using value_type = Type;
+    struct entry
+    {
+        const void * m_heap;
+        std::uintptr_t m_begin;
+        std::uintptr_t m_end;
+        deallocate_function m_deallocate;
+    };
 
-    Type * allocate(std::size_t size) noexcept
+    // An entry behind a sequence lock, written under the registry lock
+    // while its version is odd, and read again if the version changed.
+    // The fields are released and acquired, so that a reader that sees
+    // any new field also sees the odd version after it.
+    struct versioned_entry
     {
-        return std::launder(reinterpret_cast<Type *>(
-            Source::get_allocator().allocate(sizeof(Type) * size)));
+        void store(const entry & value) noexcept
+        {
+            auto version = m_version.load(std::memory_order_relaxed);
+            m_version.store(version + 1, std::memory_order_relaxed);
+            m_heap.store(value.m_heap, std::memory_order_release);
+            m_begin.store(value.m_begin, std::memory_order_release);
+            m_end.store(value.m_end, std::memory_order_release);
+            m_deallocate.store(value.m_deallocate, std::memory_order_release);
+            m_version.store(version + 2, std::memory_order_release);
+        }
+
+        entry load() const noexcept
+        {
+            while (true) {
+                auto version = m_version.load(std::memory_order_acquire);
+                entry value{m_heap.load(std::memory_order_acquire),
+                            m_begin.load(std::memory_order_acquire),
+                            m_end.load(std::memory_order_acquire),
+                            m_deallocate.load(std::memory_order_acquire)};
+                if (!(version & 1) &&
+                    m_version.load(std::memory_order_relaxed) == version) {
+                    return value;
+                }
+            }
+        }
+
+        std::atomic<std::size_t> m_version;
+        std::atomic<const void *> m_heap;
+        std::atomic<std::uintptr_t> m_begin;
+        std::atomic<std::uintptr_t> m_end;
+        std::atomic<deallocate_function> m_deallocate;
+    };
+
+    constexpr static std::size_t granule_shift = 16;
+    constexpr static std::size_t leaf_bits = 16;
+    constexpr static std::size_t address_bits =
+        sizeof(std::uintptr_t) * 8 < 48 ? sizeof(std::uintptr_t) * 8 : 48;
+    constexpr static std::size_t root_bits =
+        address_bits - granule_shift - leaf_bits;
+    constexpr static std::uintptr_t max_address =
+        std::uintptr_t(~std::uintptr_t{}) >>
+        (sizeof(std::uintptr_t) * 8 - address_bits);
+    constexpr static std::uint8_t empty = 0;
+    constexpr static std::uint8_t shared = 0xff;
+
+    struct leaf
+    {
+        std::atomic<std::uint8_t> m_slots[std::size_t(1) << leaf_bits];
+    };
+
+    template <typename Heap>
+    static void deallocate(const void * heap, std::byte * pointer) noexcept
+    {
+        auto & owner = *static_cast<const Heap *>(heap);
+        owner.deallocate(pointer, owner.allocation_size(pointer));
     }
 
-    void deallocate(Type * pointer, std::size_t size) noexcept
+    static leaf * leaf_of(std::uintptr_t granule, bool create) noexcept
     {
-        return Source::get_allocator().deallocate(
-            reinterpret_cast<std::byte *>(pointer), sizeof(Type) * size);
+        auto & root = m_root[granule >> leaf_bits];
+        auto leaf = root.load(std::memory_order_acquire);
+        if (!leaf && create) {
+            leaf = ::new (std::nothrow) registry::leaf{};
+            root.store(leaf, std::memory_order_release);
+        }
+        return leaf;
+    }
+
+    static std::size_t slot_index(std::uintptr_t granule) noexcept
+    {
+        return granule & ((std::uintptr_t(1) << leaf_bits) - 1);
+    }
+
+    // Only called for granules whose leaf exists.
+    static std::atomic<std::uint8_t> &
+    slot_of(std::uintptr_t granule) noexcept
+    {
+        return leaf_of(granule, false)->m_slots[slot_index(granule)];
+    }
+
+    // The slot value of a granule according to the registered heaps. A
+    // granule covered whole by nested ranges belongs to the innermost of
+    // them, only a granule that also holds the end of a range is shared.
+    static std::uint8_t owner_of(std::uintptr_t granule) noexcept
+    {
+        auto begin = granule << granule_shift;
+        auto last = begin + ((std::uintptr_t(1) << granule_shift) - 1);
+        auto value = empty;
+        std::uintptr_t size{};
+        std::size_t count{};
+        bool partial{};
+        for (std::size_t index = 0; index < capacity; ++index) {
+            auto entry = m_entries[index].load();
+            if (!entry.m_heap || entry.m_end <= begin ||
+                last < entry.m_begin) {
+                continue;
+            }
+            ++count;
+            partial = partial || begin < entry.m_begin ||
+                      entry.m_end - 1 < last;
+            if (value == empty || entry.m_end - entry.m_begin < size) {
+                value = static_cast<std::uint8_t>(index + 1);
+                size = entry.m_end - entry.m_begin;
+            }
+        }
+        return count > 1 && partial ? shared : value;
+    }
+
+    static entry find(const void * pointer) noexcept
+    {
+        auto address = reinterpret_cast<std::uintptr_t>(pointer);
+        if (address > max_address) {
+            return {};
+        }
+        auto granule = address >> granule_shift;
+        auto leaf = leaf_of(granule, false);
+        if (!leaf) {
+            return {};
+        }
+
+        auto slot =
+            leaf->m_slots[slot_index(granule)].load(std::memory_order_acquire);
+        if (slot == empty) {
+            return {};
+        }
+        if (slot != shared) {
+            auto entry = m_entries[slot - 1].load();
+            if (entry.m_begin <= address && address < entry.m_end) {
+                return entry;
+            }
+            return {};
+        }
+
+        // The entries of a shared granule are read under the lock, the
+        // innermost of nested ranges owns the pointer.
+        guard<spin_lock> lock(m_lock);
+        entry owner{};
+        for (auto & versioned : m_entries) {
+            auto entry = versioned.load();
+            if (entry.m_heap && entry.m_begin <= address &&
+                address < entry.m_end &&
+                (!owner.m_heap ||
+                 entry.m_end - entry.m_begin < owner.m_end - owner.m_begin)) {
+                owner = entry;
+            }
+        }
+        return owner;
     }
+
+    inline static std::atomic<leaf *> m_root[std::size_t(1) << root_bits]{};
+    inline static versioned_entry m_entries[capacity]{};
+    inline static spin_lock m_lock{};
 };
 
+// Deallocates a pointer allocated from any heap in the registry.
+inline bool free(void * pointer) noexcept
+{
+    return registry::free(pointer);
+}
+
 } // namespace zpp
 
 #endif